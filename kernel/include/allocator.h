@@ -37,6 +37,7 @@ void *buddy_pop(Buddy *, int);
 void *buddy_alloc(unsigned int);
 void *release_redundant(Frame *, int);
 void buddy_free(void *);
+void __buddy_free(void *);
 Frame *find_buddy_frame(Frame*, int);
 int addr_to_frame_idx(void *);
 
@@ -0,0 +1,71 @@
+#ifndef ATOMIC_H_
+#define ATOMIC_H_
+
+/* 
+ * Atomic operations with ldaxr/stlxr,
+ * the kernel is built without the outline atomics of libgcc.
+ * The exclusives need Normal cacheable memory: every core turns on the MMU (mmu.h) before using them.
+ */
+
+/* store new, return the old value */
+static inline unsigned long atomic_xchg(volatile unsigned long *ptr, unsigned long new){
+    unsigned long old;
+    unsigned int status;
+    asm volatile(
+        "1: ldaxr %0, [%2]\n\t"
+        "   stlxr %w1, %3, [%2]\n\t"
+        "   cbnz %w1, 1b\n\t"
+        :"=&r"(old), "=&r"(status)
+        :"r"(ptr), "r"(new)
+        :"memory"
+    );
+    return old;
+}
+
+/* store new if the value is old, return the value read */
+static inline unsigned long atomic_cmpxchg(volatile unsigned long *ptr, unsigned long old, unsigned long new){
+    unsigned long val;
+    unsigned int status;
+    asm volatile(
+        "1: ldaxr %0, [%2]\n\t"
+        "   cmp %0, %3\n\t"
+        "   b.ne 2f\n\t"
+        "   stlxr %w1, %4, [%2]\n\t"
+        "   cbnz %w1, 1b\n\t"
+        "2:\n\t"
+        :"=&r"(val), "=&r"(status)
+        :"r"(ptr), "r"(old), "r"(new)
+        :"memory", "cc"
+    );
+    return val;
+}
+
+static inline unsigned int atomic_xchg32(volatile unsigned int *ptr, unsigned int new){
+    unsigned int old, status;
+    asm volatile(
+        "1: ldaxr %w0, [%2]\n\t"
+        "   stlxr %w1, %w3, [%2]\n\t"
+        "   cbnz %w1, 1b\n\t"
+        :"=&r"(old), "=&r"(status)
+        :"r"(ptr), "r"(new)
+        :"memory"
+    );
+    return old;
+}
+
+/* set the bits of mask, return the old value */
+static inline unsigned int atomic_fetch_or32(volatile unsigned int *ptr, unsigned int mask){
+    unsigned int old, new, status;
+    asm volatile(
+        "1: ldaxr %w0, [%3]\n\t"
+        "   orr %w1, %w0, %w4\n\t"
+        "   stlxr %w2, %w1, [%3]\n\t"
+        "   cbnz %w2, 1b\n\t"
+        :"=&r"(old), "=&r"(new), "=&r"(status)
+        :"r"(ptr), "r"(mask)
+        :"memory"
+    );
+    return old;
+}
+
+#endif
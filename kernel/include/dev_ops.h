@@ -9,6 +9,7 @@ void dev_ops_init();
 int uart_dev_write(struct file* file, const void* buf, size_t len);
 int uart_dev_read(struct file* file, void* buf, size_t len);
 int framebuf_dev_write(struct file* file, const void* buf, size_t len);
+int framebuf_dev_pwrite(struct file* file, const void* buf, size_t len, long pos);
 
 
 #endif
\ No newline at end of file
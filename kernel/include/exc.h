@@ -5,7 +5,8 @@
 void exception_handler( unsigned long long, 
                         unsigned long long, 
                         unsigned long long,
-                        TrapFrame *);
+                        TrapFrame *,
+                        unsigned long long);
 
 void syscall_handler(unsigned int syscall_id, TrapFrame *trapFrame);
 
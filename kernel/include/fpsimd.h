@@ -0,0 +1,50 @@
+#ifndef FPSIMD_H_
+#define FPSIMD_H_
+
+/* 
+ * CPACR_EL1.FPEN, bits [21:20]
+ * 0b01: trap the FP/SIMD access from EL0 only (the kernel can save/load the registers)
+ * 0b11: no trap
+ */
+#define CPACR_FPEN_MASK (3 << 20)
+#define CPACR_FPEN_TRAP_EL0 (1 << 20)
+#define CPACR_FPEN_NO_TRAP (3 << 20)
+
+/* ESR_EL1.EC of the trapped FP/SIMD access */
+#define EC_FPSIMD_ACC 0b000111
+
+struct _Thread;
+
+/* v0-v31 (128 bits each), fpsr and fpcr, stp q needs 16-byte alignment without MMU */
+typedef struct _FpsimdState{
+    unsigned long vregs[64];
+    unsigned int fpsr;
+    unsigned int fpcr;
+}__attribute__((aligned(16))) FpsimdState;
+
+extern void fpsimd_save_state(FpsimdState *);
+extern void fpsimd_load_state(FpsimdState *);
+
+static inline int fpsimd_enabled(){
+    unsigned long cpacr;
+    asm volatile("mrs %0, cpacr_el1\n\t" :"=r"(cpacr));
+    return (cpacr & CPACR_FPEN_MASK) == CPACR_FPEN_NO_TRAP;
+}
+
+static inline void fpsimd_set_trap(unsigned long fpen){
+    unsigned long cpacr;
+    asm volatile("mrs %0, cpacr_el1\n\t" :"=r"(cpacr));
+    cpacr = (cpacr & ~CPACR_FPEN_MASK) | fpen;
+    asm volatile(
+        "msr cpacr_el1, %0\n\t"
+        "isb\n\t"
+        ::"r"(cpacr)
+    );
+}
+
+void fpsimd_thread_switch(struct _Thread *, struct _Thread *);
+void fpsimd_acc_handler();
+void fpsimd_flush_thread(struct _Thread *);
+void fpsimd_fork(struct _Thread *, struct _Thread *);
+
+#endif
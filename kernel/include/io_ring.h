@@ -0,0 +1,90 @@
+#ifndef IO_RING_H_
+#define IO_RING_H_
+#include <stddef.h>
+
+/*
+ * The batched syscall ring shared with EL0.
+ * IO_RING_SETUP allocates it for the calling thread and returns its address.
+ * The user fills the sqes and moves sq_tail, IO_RING_ENTER runs them in order and
+ * puts one cqe each, the user reaps them up to cq_tail and moves cq_head.
+ * The ring is kmalloc memory, EL0 reaches it because the ram is mapped EL0 RW (mmu.h),
+ * nothing keeps another EL0 thread out of it.
+ * The head/tail are free running, the slot of n is n & (IO_RING_ENTRIES - 1).
+ */
+#define IO_RING_ENTRIES     32 // power of 2
+
+/* the ops, the same as the syscalls */
+#define IO_RING_OP_NOP      0
+#define IO_RING_OP_OPEN     1 // addr: path, len: flags
+#define IO_RING_OP_CLOSE    2
+#define IO_RING_OP_READ     3 // addr: buf, len: count
+#define IO_RING_OP_WRITE    4 // addr: buf, len: count
+#define IO_RING_OP_LSEEK64  5 // off: offset, len: whence
+
+/* the fd of the last successful IO_RING_OP_OPEN in the same IO_RING_ENTER, open/read/close in one trap */
+#define IO_RING_FD_LAST     (-2)
+
+typedef struct _IoRingSqe{
+    unsigned int opcode;
+    int fd;
+    unsigned long addr;
+    unsigned long len;
+    long off;
+    unsigned long user_data; // copied to the cqe
+}IoRingSqe;
+
+typedef struct _IoRingCqe{
+    unsigned long user_data;
+    long res; // the return value of the syscall
+}IoRingCqe;
+
+typedef struct _IoRing{
+    volatile unsigned int sq_head; // the kernel moves it
+    volatile unsigned int sq_tail; // the user moves it
+    volatile unsigned int cq_head; // the user moves it
+    volatile unsigned int cq_tail; // the kernel moves it
+    unsigned int entries; // IO_RING_ENTRIES, only informational, the kernel never trusts it
+    unsigned int dropped; // the sqes with a bad opcode, they get no cqe
+    IoRingSqe sqes[IO_RING_ENTRIES];
+    IoRingCqe cqes[IO_RING_ENTRIES];
+}IoRing;
+
+/* the user side, NULL when the sq is full */
+static inline IoRingSqe *io_ring_get_sqe(IoRing *ring){
+    unsigned int tail = ring->sq_tail;
+    if(tail - ring->sq_head >= IO_RING_ENTRIES) return NULL;
+    IoRingSqe *sqe = &ring->sqes[tail & (IO_RING_ENTRIES - 1)];
+    sqe->opcode = IO_RING_OP_NOP;
+    sqe->fd = -1;
+    sqe->addr = 0;
+    sqe->len = 0;
+    sqe->off = 0;
+    sqe->user_data = 0;
+    return sqe;
+}
+
+/* publish the sqe from io_ring_get_sqe, the kernel sees it at the next IO_RING_ENTER */
+static inline void io_ring_queue_sqe(IoRing *ring){
+    asm volatile("dmb ishst\n\t" ::: "memory");
+    ring->sq_tail = ring->sq_tail + 1;
+}
+
+/* the next cqe or NULL, io_ring_cqe_seen releases it */
+static inline IoRingCqe *io_ring_peek_cqe(IoRing *ring){
+    unsigned int head = ring->cq_head;
+    if(head == ring->cq_tail) return NULL;
+    asm volatile("dmb ishld\n\t" ::: "memory");
+    return &ring->cqes[head & (IO_RING_ENTRIES - 1)];
+}
+
+static inline void io_ring_cqe_seen(IoRing *ring){
+    asm volatile("dmb ish\n\t" ::: "memory");
+    ring->cq_head = ring->cq_head + 1;
+}
+
+struct _Thread;
+void io_ring_free(struct _Thread *);
+IoRing *do_io_ring_setup();
+int do_io_ring_enter(IoRing *, unsigned int);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <gpio.h>
 #include <syscall.h>
+#include <smp.h>
 
 #define IRQ_BASIC_PENDING	    ((volatile unsigned int*)(MMIO_BASE+0x0000B200))
 #define IRQ_PENDING_1	    	((volatile unsigned int*)(MMIO_BASE+0x0000B204))
@@ -16,6 +17,9 @@
 #define DISABLE_BASIC_IRQS	    ((volatile unsigned int*)(MMIO_BASE+0x0000B224))
 #define CORE0_TIMER_IRQ_CTRL	(volatile unsigned int*)0x40000040
 #define CORE0_IRQ_SOURCE	    (volatile unsigned int*)0x40000060
+/* every core has its own timer irq control and irq source register */
+#define CORE_TIMER_IRQ_CTRL(n)	((volatile unsigned int*)(0x40000040UL + 4 * (n)))
+#define CORE_IRQ_SOURCE(n)	    ((volatile unsigned int*)(0x40000060UL + 4 * (n)))
 
 #define SYSTEM_TIMER_IRQ_0	(1 << 0)
 #define SYSTEM_TIMER_IRQ_1	(1 << 1)
@@ -23,9 +27,46 @@
 #define SYSTEM_TIMER_IRQ_3	(1 << 3)
 #define NON_SECURE_TIMER_IRQ	(1 << 1)
 
-void irq_handler(unsigned long long, TrapFrame*);
-void Time_interrupt(unsigned long long);
-void GPU_interrupt();
+/*
+ * The irq numbers of request_irq
+ * 0~31: IRQ_PENDING_1, 32~63: IRQ_PENDING_2 of the BCM2835 interrupt controller, routed to core 0
+ * 64~75: the bits of CORE_IRQ_SOURCE, local to every core
+ */
+#define NR_GPU_IRQS         64
+#define IRQ_LOCAL_BASE      NR_GPU_IRQS
+#define IRQ_LOCAL(n)        (IRQ_LOCAL_BASE + (n))
+#define NR_LOCAL_IRQS       12
+#define NR_IRQS             (IRQ_LOCAL_BASE + NR_LOCAL_IRQS)
+
+#define IRQ_AUX             29 // mini uart
+#define IRQ_UART0           57 // pl011
+#define IRQ_CNTPNS          IRQ_LOCAL(1) // the el1 physical timer
+#define LOCAL_IRQ_GPU       8 // the bit of CORE_IRQ_SOURCE for IRQ_PENDING_1/2
+
+typedef void (*IrqHandler)(unsigned int, void *);
+
+typedef struct _IrqDesc{
+    IrqHandler handler;
+    void *dev_id;
+    const char *name;
+    /* stat, every cpu counts its own */
+    unsigned long long count[NR_CPUS];
+    unsigned long long time[NR_CPUS]; // ticks in the handler
+}IrqDesc;
+
+/* log2 histograms, bucket n: [2^(n-1), 2^n) ticks of cntpct, the last one has all the longer ones */
+#define IRQ_HIST_BUCKETS    27
+
+void irq_init();
+int request_irq(unsigned int, IrqHandler, const char *, void *);
+void free_irq(unsigned int, void *);
+void print_irqs();
+void trace_irq_entry(unsigned long long, unsigned long long);
+void trace_irq_exit(unsigned long long);
+void print_irq_hist();
+
+void irq_handler(unsigned long long, TrapFrame*, unsigned long long);
+void Time_interrupt(unsigned int, void *);
 
 #define TRANSMIT_HOLDING 0b10
 #define RECEIVE_VALID 0b100
@@ -0,0 +1,16 @@
+#ifndef KPRINTF_H_
+#define KPRINTF_H_
+#include <stdarg.h>
+
+/*
+ * The kernel printf, formats a line in one pass:
+ * %d %i %u %x %X %p %s %c %%, the length modifiers l ll z,
+ * the flags '-' (left-justify) '0' (zero padding) and the width (or '*').
+ * ksnprintf returns the length of the whole output like snprintf, buf is always terminated.
+ */
+int kvsnprintf(char *, unsigned long, const char *, va_list);
+int ksnprintf(char *, unsigned long, const char *, ...) __attribute__((format(printf, 3, 4)));
+/* format into a line buffer and write it to the uart at once */
+int kprintf(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
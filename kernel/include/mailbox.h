@@ -19,12 +19,19 @@
 /* tags */
 #define GET_BOARD_REVISION  0x00010002
 #define GET_ARM_MEMORY      0x00010005
+#define SET_CLOCK_RATE      0x00038002
 #define REQUEST_CODE        0x00000000
 #define REQUEST_SUCCEED     0x80000000
 #define REQUEST_FAILED      0x80000001
 #define TAG_REQUEST_CODE    0x00000000
 #define END_TAG             0x00000000
 
+/* clock ids */
+#define CLOCK_ID_EMMC       1
+#define CLOCK_ID_UART       2
+#define CLOCK_ID_ARM        3
+#define CLOCK_ID_CORE       4
+
 /* channels */
 #define MAILBOX_CH_POWER    0
 #define MAILBOX_CH_FB       1
@@ -43,6 +50,7 @@
 
 unsigned int get_board_revision(unsigned int [36]);
 unsigned int get_arm_memory(unsigned int [36]);
+unsigned int set_clock_rate(unsigned int [36], unsigned int, unsigned int);
 void framebuffer_init();
 unsigned int mailbox_call(unsigned int *, unsigned char);
 
@@ -0,0 +1,95 @@
+#ifndef MMU_H_
+#define MMU_H_
+
+/*
+ * The identity map of every core, 4KB granule and a 4GB address space (T0SZ = 32, starts at level 1).
+ * The ram is Normal write-back so ldaxr/stxr of the locks work, with the MMU off it is Device memory.
+ * The EL0 programs share the address space: the ram and the peripherals are EL0 RW and never
+ * executable at EL1, only the kernel text/rodata is executable at EL1 (EL0 RO).
+ *   0x00000000 - 0x001fffff  4KB pages: [_start, _etext) RO, the rest RW
+ *   0x00200000 - 0x3effffff  2MB blocks, Normal WB
+ *   0x3f000000 - 0x3fffffff  2MB blocks, Device (the peripherals)
+ *   0x40000000 - 0x7fffffff  1GB block, Device, EL1 only (the local peripherals)
+ */
+
+/* MAIR_EL1 */
+#define MT_DEVICE_nGnRnE    0
+#define MT_NORMAL           1
+#define MAIR_VALUE          ((0x00 << (MT_DEVICE_nGnRnE * 8)) | (0xff << (MT_NORMAL * 8)))
+
+/* TCR_EL1: T0SZ = 32, inner/outer WB WA inner shareable walks, 4KB granule, no TTBR1 walks */
+#define TCR_T0SZ            32
+#define TCR_VALUE           (TCR_T0SZ | (1 << 8) | (1 << 10) | (3 << 12) | (1 << 23))
+
+/* SCTLR_EL1: the RES1 bits, I, C and M */
+#define SCTLR_RES1          0x30d00800
+#define SCTLR_VALUE         (SCTLR_RES1 | (1 << 12) | (1 << 2) | (1 << 0))
+
+/* the descriptors */
+#define PD_TABLE            3
+#define PD_BLOCK            1
+#define PD_PAGE             3
+#define PD_ATTR(mt)         ((mt) << 2)
+#define PD_EL0_RW           (1 << 6)
+#define PD_RO               (3 << 6) // EL1 and EL0 RO
+#define PD_INNER_SHARE      (3 << 8)
+#define PD_AF               (1 << 10)
+#define PD_PXN              (1UL << 53)
+#define PD_UXN              (1UL << 54)
+
+#define PAGE_SHIFT          12
+#define PMD_SHIFT           21
+#define PGD_SHIFT           30
+#define PTRS_PER_TABLE      512
+#define PERIPHERAL_BASE     0x3f000000
+#define LOCAL_PERIPHERAL_BASE 0x40000000
+
+#define CACHE_LINE_SIZE     64
+
+#ifndef __ASSEMBLY__
+
+/* the level 1 table, TTBR0_EL1 of every core */
+extern unsigned long pg_dir[PTRS_PER_TABLE];
+
+void mmu_init();
+/* start.S, load the tables and turn on the MMU and the caches of this core */
+extern void enable_mmu();
+
+/*
+ * The ram seen by the other bus masters (the GPU through the mailbox, the framebuffer)
+ * and by the cores with the MMU off (the spin table).
+ */
+static inline void dcache_clean_range(const void *start, unsigned long size){
+    unsigned long addr = (unsigned long)start & ~(CACHE_LINE_SIZE - 1UL);
+    unsigned long end = (unsigned long)start + size;
+    for(; addr < end; addr += CACHE_LINE_SIZE)
+        asm volatile("dc cvac, %0\n\t" ::"r"(addr) :"memory");
+    asm volatile("dsb sy\n\t" ::: "memory");
+}
+
+static inline void dcache_clean_inval_range(const void *start, unsigned long size){
+    unsigned long addr = (unsigned long)start & ~(CACHE_LINE_SIZE - 1UL);
+    unsigned long end = (unsigned long)start + size;
+    for(; addr < end; addr += CACHE_LINE_SIZE)
+        asm volatile("dc civac, %0\n\t" ::"r"(addr) :"memory");
+    asm volatile("dsb sy\n\t" ::: "memory");
+}
+
+/*
+ * The code written with the data stores (a loaded program), before any core runs it.
+ * Clean the D-cache to the PoU, then drop the stale lines of the I-cache of every core.
+ */
+static inline void sync_icache_range(const void *start, unsigned long size){
+    unsigned long base = (unsigned long)start & ~(CACHE_LINE_SIZE - 1UL);
+    unsigned long end = (unsigned long)start + size;
+    for(unsigned long addr = base; addr < end; addr += CACHE_LINE_SIZE)
+        asm volatile("dc cvau, %0\n\t" ::"r"(addr) :"memory");
+    asm volatile("dsb ish\n\t" ::: "memory");
+    for(unsigned long addr = base; addr < end; addr += CACHE_LINE_SIZE)
+        asm volatile("ic ivau, %0\n\t" ::"r"(addr) :"memory");
+    asm volatile("dsb ish\n\tisb\n\t" ::: "memory");
+}
+
+#endif
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef OFFSETS_H_
+#define OFFSETS_H_
+
+/*
+ * The struct offsets used in the assembly, checked by _Static_assert in the C file of the struct.
+ */
+
+/* Thread.id: list(16) + ctx(13 * 8) + state(4) */
+#define THREAD_ID_OFFSET    124
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef PL011_H_
+#define PL011_H_
+#include <gpio.h>
+#include <uart.h>
+
+/* PL011 UART0, the bluetooth uart by default, mapped to gpio 14/15 (ALT0) and RTS/CTS to gpio 17/16 (ALT3) */
+#define UART0_BASE      (MMIO_BASE + 0x00201000)
+#define UART0_DR        ((volatile unsigned int*)(UART0_BASE+0x00))
+#define UART0_FR        ((volatile unsigned int*)(UART0_BASE+0x18))
+#define UART0_IBRD      ((volatile unsigned int*)(UART0_BASE+0x24))
+#define UART0_FBRD      ((volatile unsigned int*)(UART0_BASE+0x28))
+#define UART0_LCRH      ((volatile unsigned int*)(UART0_BASE+0x2C))
+#define UART0_CR        ((volatile unsigned int*)(UART0_BASE+0x30))
+#define UART0_IFLS      ((volatile unsigned int*)(UART0_BASE+0x34))
+#define UART0_IMSC      ((volatile unsigned int*)(UART0_BASE+0x38))
+#define UART0_RIS       ((volatile unsigned int*)(UART0_BASE+0x3C))
+#define UART0_MIS       ((volatile unsigned int*)(UART0_BASE+0x40))
+#define UART0_ICR       ((volatile unsigned int*)(UART0_BASE+0x44))
+
+/* UART0_FR */
+#define FR_BUSY         (1 << 3)
+#define FR_RXFE         (1 << 4) // rx fifo empty
+#define FR_TXFF         (1 << 5) // tx fifo full
+#define FR_RXFF         (1 << 6) // rx fifo full
+#define FR_TXFE         (1 << 7) // tx fifo empty
+
+/* UART0_LCRH */
+#define LCRH_FEN        (1 << 4)
+#define LCRH_WLEN_8     (3 << 5)
+
+/* UART0_CR */
+#define CR_UARTEN       (1 << 0)
+#define CR_TXE          (1 << 8)
+#define CR_RXE          (1 << 9)
+#define CR_RTSEN        (1 << 14)
+#define CR_CTSEN        (1 << 15)
+
+/* UART0_IFLS, the fifo level of the interrupt */
+#define IFLS_1_8        0
+#define IFLS_1_4        1
+#define IFLS_1_2        2
+#define IFLS_TX(lvl)    ((lvl) << 0)
+#define IFLS_RX(lvl)    ((lvl) << 3)
+
+/* UART0_IMSC/RIS/MIS/ICR */
+#define INT_RX          (1 << 4)
+#define INT_TX          (1 << 5)
+#define INT_RT          (1 << 6) // rx timeout, the rx fifo has data below the level for 32 bits
+#define INT_OE          (1 << 10) // rx overrun
+#define INT_ALL         0x7ff
+
+#define PL011_FIFO_SIZE 16
+/* the uart clock set by the mailbox, 16x oversampling: the highest baud is 3000000 */
+#define PL011_CLOCK     48000000
+/* 1: the hardware RTS/CTS flow control, the cable needs the RTS/CTS lines */
+#define PL011_FLOW_CTRL 1
+
+extern const UartOps pl011_ops;
+
+void pl011_init(unsigned int);
+int pl011_set_baud(unsigned int);
+void pl011_irq_handler(unsigned int, void *);
+
+#endif
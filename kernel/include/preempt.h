@@ -0,0 +1,26 @@
+#ifndef PREEMPT_H_
+#define PREEMPT_H_
+
+/*
+ * preempt_count of the thread
+ * [7:0]   preempt_disable depth (spinlocks held)
+ * [15:8]  softirq (do_softirq is running)
+ * [23:16] hard irq nesting
+ * The thread can be scheduled out in the kernel only when it is 0.
+ */
+#define PREEMPT_MASK 0x000000ff
+#define SOFTIRQ_OFFSET 0x00000100
+#define SOFTIRQ_MASK 0x0000ff00
+#define HARDIRQ_OFFSET 0x00010000
+#define HARDIRQ_MASK 0x00ff0000
+
+void preempt_disable();
+void preempt_enable();
+void preempt_enable_no_resched();
+void preempt_schedule();
+void set_need_resched();
+void irq_enter();
+void irq_exit();
+void print_sched_latency();
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef PRINTK_H_
+#define PRINTK_H_
+#include <kprintf.h>
+
+/* the log levels, the lower is the more important */
+#define LOGLEVEL_ERR        3
+#define LOGLEVEL_WARNING    4
+#define LOGLEVEL_NOTICE     5
+#define LOGLEVEL_INFO       6
+#define LOGLEVEL_DEBUG      7
+
+/* the messages above this level are compiled out */
+#define PRINTK_LEVEL        LOGLEVEL_INFO
+/* the default of console_loglevel, the messages above it only go to dmesg */
+#define CONSOLE_LOGLEVEL    LOGLEVEL_INFO
+
+/*
+ * The kernel log ring (dmesg), every line is stored as "<level>text\n".
+ * The oldest lines are overwritten, the console is flushed by a work on the kworker.
+ */
+#define LOG_BUF_SIZE        16384
+/* the bytes moved to the uart tx ring at a time */
+#define CONSOLE_CHUNK       128
+
+extern int console_loglevel;
+
+/* printk(level, fmt, ...), formatted by kvsnprintf and stored at once */
+#define printk(level, ...) \
+    do{ if((level) <= PRINTK_LEVEL) log_printf(level, __VA_ARGS__); }while(0)
+
+void printk_init();
+void log_write(int, const char *);
+void log_printf(int, const char *, ...) __attribute__((format(printf, 2, 3)));
+void print_dmesg();
+void loglevel_arg(char *);
+
+#endif
@@ -3,16 +3,25 @@
 #include <stddef.h>
 #include <list.h>
 #include <vfs.h>
+#include <smp.h>
+#include <fpsimd.h>
+#include <preempt.h>
+#include <timer.h>
 
 #define MAX_THREAD 0x100
 #define MAX_SIG_HANDLER 0x20
 #define STACK_SIZE 0x1000
+#define ZOMBIE_REAP_BATCH 4
+#define BENCH_THREADS 8
+#define THREAD_NAME_LEN 16
+#define EXIT_CODE_KILLED 137 // 128 + 9 (SIGKILL), as the shells report it
 
 
 
 enum thread_state{
     NOUSE,
     RUNNING,
+    SLEEPING, // parked by nanosleep, not in any runqueue
     EXIT
 };
 
@@ -44,11 +53,38 @@ typedef struct _Thread{
     CpuContext ctx;
     enum thread_state state;
     int id;
+    char name[THREAD_NAME_LEN]; // kernel threads only
     void *ustack_addr;
     void *kstack_addr;
     void *code_addr; // use in exec
     unsigned int code_size; // use in exec
 
+    /* smp */
+    int cpu; // the cpu it runs on or is queued on
+    volatile int on_cpu; // 1 until its context is saved by cpu_switch_to
+    unsigned int cpus_allowed; // affinity mask, bit n is cpu n
+
+    /* preemption */
+    unsigned int preempt_count; // see preempt.h
+    volatile int need_resched; // schedule at the next preemption point
+
+    /* cpu time accounting (ticks of cntpct) */
+    unsigned long long utime;
+    unsigned long long stime;
+    unsigned long long irqtime;
+    unsigned int nvcsw; // voluntary switches (schedule, exit)
+    unsigned int nivcsw; // involuntary switches (preempted)
+
+    unsigned long long wakeup_time; // cntpct, when it is SLEEPING
+    Hrtimer sleep_timer; // wakes it up from sleep_ticks, inited once with the pool
+    unsigned int timer_slack_us; // sleep_ticks may oversleep this much to share the timer irq
+
+    /* process tree, protected by thread_pool_lock */
+    struct _Thread *parent; // NULL: reaped by the idle thread when it exits
+    struct list_head children; // the threads whose parent is this one, linked by sibling
+    struct list_head sibling;
+    int exit_code;
+
     /* signal */
     SignalInfo sig_info_pool[MAX_SIG_HANDLER]; // all signal info
     SignalInfo sig_queue_head; // ready queue
@@ -59,21 +95,84 @@ typedef struct _Thread{
     char dir[MAX_PATHNAME_LEN * 16];
     Dentry *dentry;
     File *fd_table[MAX_FD_NUM]; // max 16 fd
+    struct _IoRing *io_ring; // IO_RING_SETUP, NULL: none
+
+    /* fp/simd, lazy switching */
+    int used_fpsimd;
+    int fpsimd_cpu; // the cpu whose registers hold the state last loaded, -1: none
+    FpsimdState fpsimd;
 }Thread;
 
+/* the stats returned by the thread_stat syscall, do_thread_stat */
+typedef struct _ThreadStat{
+    int pid;
+    int cpu;
+    int state;
+    unsigned long long utime_us;
+    unsigned long long stime_us;
+    unsigned long long irqtime_us;
+    unsigned int nvcsw;
+    unsigned int nivcsw;
+}ThreadStat;
+
+/* the time since the last charge goes to the current thread as */
+enum acct_type{
+    ACCT_USER,
+    ACCT_SYS,
+    ACCT_IRQ
+};
+
 extern Thread* get_current();
-extern void cpu_switch_to(Thread* prev, Thread* next);
+
+/* not exited, running or sleeping */
+static inline int thread_is_alive(Thread *thread){
+    return thread->state == RUNNING || thread->state == SLEEPING;
+}
+
+/* the working directory and fd table of the running thread */
+#define global_dir (get_current()->dir)
+#define global_dentry (get_current()->dentry)
+#define global_fd_table (get_current()->fd_table)
+extern Thread* cpu_switch_to(Thread* prev, Thread* next);
+extern void ret_from_kthread();
+extern void ret_from_fork();
 
 void init_thread_pool_and_head();
+Thread *thread_alloc();
 Thread *thread_create();
+Thread *kthread_create(void(*)(), const char *, int);
+Thread *thread_init_current();
+void idle_thread_init();
+void wake_up_new_thread(Thread *);
+void enqueue_thread(Thread *, unsigned int);
+void dequeue_thread(Thread *);
+unsigned int select_cpu(Thread *);
+int steal_thread(Cpu *);
+int do_sched_setaffinity(int, unsigned int);
+int do_sched_getaffinity(int);
+int thread_to_zombie(Thread *, int);
+int wake_up_thread(Thread *);
+void sleep_ticks(unsigned long long);
+int prepare_to_sleep();
+void sleep_cancel();
+void thread_set_parent(Thread *, Thread *);
+int wait_child(int, int *, int);
 void kill_zombie();
+void reap_thread(Thread *);
 void idle_thread();
 void schedule();
+void account_cpu_time(int);
+void account_exc_enter(unsigned long long);
+int do_thread_stat(int, ThreadStat *);
+void print_top();
+void schedule_tail(Thread *);
+void sched_softirq();
 void kernel_main();
 void delay(unsigned long long);
 void foo();
 
 void print_run_thread();
+void sched_bench(char *);
  
 
 #endif
\ No newline at end of file
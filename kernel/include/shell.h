@@ -39,5 +39,7 @@ void mkdir_arg(char *);
 void mount_arg(char *);
 void umount_arg(char *);
 void exec_arg(char *);
+void run_arg(char *);
+void sched_bench_arg(char *);
 
 #endif
\ No newline at end of file
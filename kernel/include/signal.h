@@ -2,7 +2,14 @@
 #define SIGNAL_H_
 
 #include <syscall.h>
+#include <spinlock.h>
 
+#define SIGCHLD 17 // a child exited, ignored by default
+
+/* protect sig_info_pool and sig_queue_head of all threads */
+extern Spinlock signal_lock;
+
+void signal_init();
 void check_sig_queue(TrapFrame*);
 void sig_default_handler();
 void sig_register_handler();
@@ -0,0 +1,78 @@
+#ifndef SMP_H_
+#define SMP_H_
+
+/* the boot constants are also used by start.S, the C part is under !__ASSEMBLY__ */
+#define NR_CPUS 4
+#define CPU_MASK_ALL ((1 << NR_CPUS) - 1)
+/* 
+ * Spin table for multicore boot, core n polls (SPIN_TABLE_BASE + 8 * n)
+ * core 0: 0xd8, core 1: 0xe0, core 2: 0xe8, core 3: 0xf0
+ */
+#define SPIN_TABLE_BASE 0xd8
+#define SECONDARY_STACK_SIZE 0x4000
+
+#ifndef __ASSEMBLY__
+#include <list.h>
+#include <spinlock.h>
+
+struct _Thread;
+
+/* per-cpu data, tpidr_el1 points to the cpu's own Cpu */
+typedef struct _Cpu{
+    struct _Thread *current; // must be the first member, used in ctx_switch.S
+    unsigned int id;
+    volatile unsigned int online;
+    struct _Thread *idle;
+
+    /* runqueue, the running thread is not in it */
+    Spinlock rq_lock;
+    struct list_head rq;
+    volatile unsigned int nr_running;
+    unsigned int nr_steal; // threads pulled from the other cpus
+
+    volatile unsigned int softirq_pending; // bit n: vector n of softirq.h
+    unsigned int nr_kick; // idle cpus woken up by SCHED_SOFTIRQ to steal
+
+    /* the hard irq part with the irq masked, from irq_enter to the softirqs (ticks) */
+    unsigned long long hardirq_start;
+    unsigned long long hardirq_max;
+    unsigned long long hardirq_total;
+    unsigned int nr_hardirq;
+
+    /* irq-off tracing (ticks), the histograms are in irq.c */
+    unsigned long long irqoff_start; // cntpct when the irq is masked, 0: unmasked
+    unsigned long long irqoff_max;
+    unsigned long long irq_lat_max; // from cntp_cval_el0 to irq_entry
+
+    unsigned long long acct_stamp; // cntpct when the cpu time was charged last
+
+    /* preemption, the latency from need_resched to the switch (ticks) */
+    unsigned long long resched_start; // cntpct when need_resched is set, 0: not pending
+    unsigned long long sched_lat_max;
+    unsigned long long sched_lat_total;
+    unsigned int nr_sched_lat;
+    unsigned int nr_preempt; // threads scheduled out on irq exit or preempt_enable
+
+    /* fp/simd, the thread whose state is in the registers */
+    struct _Thread *fpsimd_last;
+    unsigned int nr_fpsimd_load;
+    unsigned int nr_fpsimd_save;
+}Cpu;
+
+extern Cpu* get_cpu();
+extern void secondary_start();
+extern unsigned char secondary_stacks[NR_CPUS - 1][SECONDARY_STACK_SIZE];
+
+static inline unsigned int smp_processor_id(){
+    unsigned long long mpidr;
+    asm volatile("mrs %0, mpidr_el1\n\t" :"=r"(mpidr));
+    return mpidr & 3;
+}
+
+void smp_init_boot_cpu();
+void smp_boot_secondaries();
+void secondary_main(unsigned int);
+
+#endif
+
+#endif
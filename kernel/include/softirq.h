@@ -0,0 +1,29 @@
+#ifndef SOFTIRQ_H_
+#define SOFTIRQ_H_
+
+/* 
+ * The bottom halves of the irq handlers, a fixed set of vectors.
+ * The top half marks the vector pending in the bitmap of its cpu,
+ * do_softirq runs them in this order (the lower number first) on irq exit with the irq enabled.
+ */
+enum softirq_vec{
+    TIMER_SOFTIRQ,
+    UART_RX_SOFTIRQ,
+    UART_TX_SOFTIRQ,
+    SCHED_SOFTIRQ,
+    NR_SOFTIRQS
+};
+
+/* the budget of one do_softirq, the rest runs on the kworker of the cpu */
+#define SOFTIRQ_MAX_RESTART 10
+#define SOFTIRQ_MAX_US 2000
+
+typedef void (*SoftirqHandler)();
+
+void softirq_init();
+void open_softirq(int, SoftirqHandler);
+void raise_softirq(int);
+void do_softirq();
+void print_softirq();
+
+#endif
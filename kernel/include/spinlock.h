@@ -0,0 +1,85 @@
+#ifndef SPINLOCK_H_
+#define SPINLOCK_H_
+#include <preempt.h>
+
+#define MAX_LOCK_STAT 32
+/* 1: record the acquire count, contention and the hold time of every lock */
+#define LOCK_STAT 1
+/* 1: record the length of every irq-masked region in a log2 histogram (irq.c) */
+#define IRQOFF_TRACE 1
+
+/*
+ * Ticket spinlock
+ * slock[15:0]: the ticket being served (owner)
+ * slock[31:16]: the next ticket to take
+ */
+typedef struct _Spinlock{
+    volatile unsigned int slock;
+    const char *name;
+
+    /* lock stat, only changed by the holder */
+    unsigned long long acquired;
+    unsigned long long contended;
+    unsigned long long hold_start; // cntpct when it is acquired
+    unsigned long long hold_max; // ticks
+    unsigned long long hold_total; // ticks
+}Spinlock;
+
+void spin_lock_init(Spinlock *, const char *);
+void raw_spin_lock(Spinlock *);
+void raw_spin_unlock(Spinlock *);
+void spin_lock(Spinlock *);
+void spin_unlock(Spinlock *);
+void print_lockstat();
+void trace_irq_off();
+void trace_irq_on();
+
+#define DAIF_I (1 << 7)
+
+/* DAIF.I */
+static inline int irqs_disabled(){
+    unsigned long flags;
+    asm volatile("mrs %0, daif\n\t" :"=r"(flags));
+    return (flags & DAIF_I) != 0;
+}
+
+/* save the DAIF and mask all the exceptions */
+static inline unsigned long local_irq_save(){
+    unsigned long flags;
+    asm volatile(
+        "mrs %0, daif\n\t"
+        "msr daifset, 0xf\n\t"
+        :"=r"(flags)
+        :
+        :"memory"
+    );
+#if IRQOFF_TRACE
+    if(!(flags & DAIF_I)) trace_irq_off();
+#endif
+    return flags;
+}
+
+static inline void local_irq_restore(unsigned long flags){
+#if IRQOFF_TRACE
+    /* close the region before the irq is unmasked */
+    if(!(flags & DAIF_I) && irqs_disabled()) trace_irq_on();
+#endif
+    asm volatile("msr daif, %0\n\t" ::"r"(flags) :"memory");
+}
+
+/* the lock is also taken in the irq handler, mask the irq of this cpu when holding it */
+static inline unsigned long spin_lock_irqsave(Spinlock *lock){
+    unsigned long flags = local_irq_save();
+    preempt_disable();
+    raw_spin_lock(lock);
+    return flags;
+}
+
+/* the pending reschedule runs after the irq is restored */
+static inline void spin_unlock_irqrestore(Spinlock *lock, unsigned long flags){
+    raw_spin_unlock(lock);
+    local_irq_restore(flags);
+    preempt_enable();
+}
+
+#endif
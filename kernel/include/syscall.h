@@ -31,6 +31,21 @@ void sys_mount(TrapFrame *);
 void sys_chdir(TrapFrame *);
 void sys_lseek64(TrapFrame *);
 void sys_ioctl(TrapFrame *);
+void sys_sched_setaffinity(TrapFrame *);
+void sys_sched_getaffinity(TrapFrame *);
+void sys_thread_stat(TrapFrame *);
+void sys_nanosleep(TrapFrame *);
+void sys_sched_yield(TrapFrame *);
+void sys_waitpid(TrapFrame *);
+void sys_vdso_data(TrapFrame *);
+void sys_settimeofday(TrapFrame *);
+void sys_null(TrapFrame *);
+void sys_io_ring_setup(TrapFrame *);
+void sys_io_ring_enter(TrapFrame *);
+void sys_readv(TrapFrame *);
+void sys_writev(TrapFrame *);
+void sys_pread64(TrapFrame *);
+void sys_pwrite64(TrapFrame *);
 
 int do_getpid();
 int do_exec(TrapFrame *trapFrame, const char *name, char *const argv[]);
@@ -41,8 +56,24 @@ void do_exit(int status);
 int do_kill(int pid);
 int do_signal_register(int signal, SigHandler handler);
 int do_signal_kill(int pid, int signal);
+struct timespec;
+struct timeval;
+int do_nanosleep(const struct timespec *req, struct timespec *rem);
+int do_waitpid(int pid, int *status, int options);
+int do_settimeofday(const struct timeval *tv);
+int do_open(const char *path, int flags);
+int do_close(int fd);
+int do_write(int fd, const char *buf, int count);
+int do_read(int fd, char *buf, int count);
+long do_lseek64(int fd, long offset, int whence);
+struct iovec;
+long do_readv(int fd, const struct iovec *iov, int iovcnt);
+long do_writev(int fd, const struct iovec *iov, int iovcnt);
+int do_pread64(int fd, char *buf, int count, long offset);
+int do_pwrite64(int fd, const char *buf, int count, long offset);
 
 int kernel_exec(char *name);
+int kernel_spawn(char *name);
 
 extern void after_fork();
 
@@ -8,6 +8,7 @@ void fs_test4();
 void fs_test5();
 void fs_test6();
 void fs_test7();
+void fs_test8();
 void user_basic1();
 void user_advance1();
 
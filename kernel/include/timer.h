@@ -3,6 +3,8 @@
 
 #include <gpio.h>
 #include <stddef.h>
+#include <list.h>
+#include <spinlock.h>
 
 // Timer interrupt
 #define TIMER_CS        ((volatile unsigned int*)(MMIO_BASE+0x00003000))
@@ -21,19 +23,113 @@
 
 typedef void (*TimerTask)(void *);
 
+/*
+ * Hierarchical timing wheel
+ * The wheel clock is cntpct >> WHEEL_SHIFT (about 1ms at 62.5MHz).
+ * Every level has LVL_SIZE buckets, the granularity of level n is LVL_GRAN(n) wheel clocks.
+ * A timer is put in a bucket by its distance to the wheel clock, so insert and delete are O(1),
+ * and it expires at the end of its bucket, later by less than the granularity of its level.
+ * The timers are never cascaded to the lower levels.
+ */
+#define WHEEL_SHIFT             16
+#define LVL_CLK_SHIFT           3
+#define LVL_CLK_DIV             (1 << LVL_CLK_SHIFT)
+#define LVL_CLK_MASK            (LVL_CLK_DIV - 1)
+#define LVL_BITS                6
+#define LVL_SIZE                (1 << LVL_BITS)
+#define LVL_MASK                (LVL_SIZE - 1)
+#define LVL_DEPTH               8
+#define WHEEL_SIZE              (LVL_SIZE * LVL_DEPTH)
+#define LVL_SHIFT(n)            ((n) * LVL_CLK_SHIFT)
+#define LVL_GRAN(n)             (1ULL << LVL_SHIFT(n))
+#define LVL_OFFS(n)             ((n) * LVL_SIZE)
+/* the first wheel clock distance of level n */
+#define LVL_START(n)            ((LVL_SIZE - 1ULL) << (((n) - 1) * LVL_CLK_SHIFT))
+/* the longer timers are clamped to the last bucket of the last level */
+#define WHEEL_TIMEOUT_CUTOFF    LVL_START(LVL_DEPTH)
+#define WHEEL_TIMEOUT_MAX       (WHEEL_TIMEOUT_CUTOFF - LVL_GRAN(LVL_DEPTH - 1))
+#define NEXT_TIMER_MAX_DELTA    ((1ULL << 62) - 1)
+
+/* allocated by add_timer, freed after the task runs */
+#define TIMER_KMALLOC           (1 << 0)
+
+#define TIMER_BENCH_NUM         10000
+/* the callbacks run by one timer_softirq, the rest runs in the next round */
+#define TIMER_MAX_RUN           32
+
+/* the timer can be embedded in other structs, init it with init_timer */
 typedef struct _Timer{
+    struct list_head entry; // must be the first member, in a bucket of the wheel
     TimerTask task;
-    unsigned long long expired_time;
     void *args;
-    struct _Timer *next;
-    struct _Timer *prev;
+    unsigned long long expired_time; // cntpct
+    unsigned int idx; // the bucket
+    int cpu; // the wheel it is pending on, -1: not pending
+    unsigned int flags;
 }Timer;
 
+/*
+ * High resolution timer, for the few timers that need the cntpct precision.
+ * It may run anywhere in [soft_expires, expires], the irq is programmed at the earliest expires,
+ * so the timers whose windows overlap share one irq.
+ */
+typedef struct _Hrtimer{
+    struct list_head entry; // must be the first member, in the list of the cpu sorted by expires
+    TimerTask task;
+    void *args;
+    unsigned long long soft_expires; // cntpct, it may run from here
+    unsigned long long expires; // soft_expires + slack, it runs by here
+    int cpu; // -1: not pending
+}Hrtimer;
+
+/* the default slack of a sleeping thread */
+#define TIMER_SLACK_US          50
+/* the scheduler tick, cntfrq >> SCHED_TICK_SHIFT */
+#define SCHED_TICK_SHIFT        5
+
+/* every cpu has its own wheel and hrtimer list */
+typedef struct _TimerBase{
+    Spinlock lock;
+    unsigned long long clk; // the wheel clock processed up to
+    unsigned long long next_expiry; // the wheel clock of the first pending bucket, may be earlier after del_timer
+    unsigned int next_expiry_recalc;
+    unsigned int timers_pending;
+    unsigned long long pending_map[LVL_DEPTH]; // bit n: bucket n of the level is not empty
+    struct list_head vectors[WHEEL_SIZE];
+    struct list_head expired; // collected from the buckets, not run yet
+    struct list_head hrtimers;
+    unsigned long long programmed; // cntp_cval_el0 written last, ~0: none
+
+    /* stat */
+    unsigned long long nr_irq; // timer_softirq runs
+    unsigned long long nr_expired; // wheel timers run
+    unsigned long long nr_hr_expired; // hrtimers run
+    unsigned long long nr_slack; // hrtimers run before their expires, in the irq of another timer
+    unsigned long long nr_saved; // timers run in an irq beyond the first, the irqs saved
+    unsigned long long nr_program; // cntp_cval_el0 writes
+    unsigned long long nr_defer; // timer_softirq out of TIMER_MAX_RUN
+    unsigned int max_run; // the most callbacks in one timer_softirq
+}TimerBase;
+
+void timers_init();
+void init_timer(Timer *, TimerTask, void *);
+int mod_timer(Timer *, unsigned long long);
+int del_timer(Timer *);
+static inline int timer_pending(Timer *timer){
+    return timer->cpu >= 0;
+}
+void hrtimer_init(Hrtimer *, TimerTask, void *);
+void hrtimer_start(Hrtimer *, unsigned long long, unsigned long long);
+int hrtimer_cancel(Hrtimer *);
+static inline int hrtimer_pending(Hrtimer *timer){
+    return timer->cpu >= 0;
+}
 void add_timer(TimerTask, unsigned long long, void *, unsigned int);
 void timeout_print(void *);
 void sched_timeout(void *);
-void timer_interrupt_handler();
-void timer_interrupt_handler_el0();
+void timer_softirq();
+void timer_bench(unsigned int);
+void print_timer_stat();
 void enable_el0_get_timer();
 
-#endif
\ No newline at end of file
+#endif
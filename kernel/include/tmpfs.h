@@ -23,6 +23,8 @@ int tmpfs_read(struct file* file, void* buf, size_t len);
 int tmpfs_open(struct vnode* file_node, struct file** target);
 int tmpfs_close(struct file* file);
 long tmpfs_lseek64(struct file* file, long offset, int whence);
+int tmpfs_pread(struct file* file, void* buf, size_t len, long pos);
+int tmpfs_pwrite(struct file* file, const void* buf, size_t len, long pos);
 
 int tmpfs_lookup(struct vnode* dir_node, struct vnode** target, const char* component_name);
 int tmpfs_create(struct vnode* dir_node, struct vnode** target, const char* component_name);
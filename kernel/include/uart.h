@@ -17,6 +17,53 @@
 #define AUX_MU_BAUD     ((volatile unsigned int*)(AUX_BASE+0x68))
 #define ENABLE_IRQS_1   ((volatile unsigned int*)(MMIO_BASE+0x0000B210))
 
+/* the mini uart has 8-byte rx/tx fifos, AUX_MU_STAT has the fill levels */
+#define AUX_MU_FIFO_SIZE            8
+#define AUX_MU_STAT_RX_LEVEL(stat)  (((stat) >> 16) & 0xf)
+#define AUX_MU_STAT_TX_LEVEL(stat)  (((stat) >> 24) & 0xf)
+
+/*
+ * The backend of the console and /dev/uart.
+ * Both uarts are wired to gpio 14/15, only the selected one is mapped.
+ * UART_PL011: set PL011_BAUD on the other side (qemu: -serial stdio for the first serial port).
+ */
+#define UART_MINI       0
+#define UART_PL011      1
+#define UART_BACKEND    UART_MINI
+/* the mini uart baud depends on the core clock, 115200 for 250MHz */
+#define PL011_BAUD      921600
+
+/*
+ * The size of write_buf, the ring of async_uart_write and async_uart_putc.
+ * A writer only blocks when it is full: 4KB is ~350ms at 115200.
+ */
+#define UART_TX_BUF_SIZE 4096
+
+/* the hardware part of a uart, the ring buffers and the softirqs in uart.c are shared */
+typedef struct _UartOps{
+    const char *name;
+    unsigned int fifo_size;
+    unsigned int (*rx_level)(); // the bytes that can be read without waiting
+    unsigned int (*tx_room)(); // the bytes that can be written without waiting
+    char (*read)();
+    void (*write)(unsigned int);
+    void (*rx_irq)(int); // 1: unmask the rx interrupt, 0: mask it
+    void (*tx_irq)(int);
+}UartOps;
+
+extern const UartOps *uart_ops;
+extern const UartOps mini_uart_ops;
+
+typedef struct _UartStat{
+    unsigned long long rx_irq;
+    unsigned long long rx_bytes;
+    unsigned long long rx_overrun; // the bytes are lost before the rx fifo is drained
+    unsigned long long tx_irq;
+    unsigned long long tx_bytes;
+    unsigned int rx_batch_max; // the most bytes drained by one UART_RX_SOFTIRQ
+    unsigned int tx_batch_max;
+}UartStat;
+
 
 /* Display a char */
 void uart_init();
@@ -27,7 +74,11 @@ void uart_putc(unsigned int);
 /* Receive a character */
 char uart_getc();
 /* Recv a new char in read buffer */
+void uart_irq_handler(unsigned int, void *);
+void print_uart_stat();
+void uart_rx_overrun();
 void recv_interrupt_handler();
+void uart_rx_softirq();
 /* Async receive a character */
 char async_uart_getc();
 
@@ -39,10 +90,14 @@ void async_uart_puts(char *);
 
 /* Transmit a character */
 void tran_interrupt_handler();
+void uart_tx_softirq();
 
 /* Async send a character */
 void async_uart_putc(unsigned int);
 
+/* Queue a buffer for the tx interrupt */
+unsigned int async_uart_write(const char *, unsigned int, int);
+
 void uart_nbyte(char *, unsigned int);
 
 void enable_AUX_MU_IER_r();
@@ -21,6 +21,40 @@
 #define CHDIR 17
 #define LSEEK64 18
 #define IOCTL 19
+#define SCHED_SETAFFINITY 20
+#define SCHED_GETAFFINITY 21
+#define THREAD_STAT 22
+#define NANOSLEEP 23
+#define SCHED_YIELD 24
+#define WAITPID 25
+#define VDSO_DATA 26
+#define SETTIMEOFDAY 27
+#define NULL_SYSCALL 28 // does nothing, the syscall latency benchmark
+#define IO_RING_SETUP 29
+#define IO_RING_ENTER 30
+#define READV 31
+#define WRITEV 32
+#define PREAD64 33
+#define PWRITE64 34
+#define NR_SYSCALLS 35
+
+/* open flags */
+#define O_CREAT 00000100
+
+/* lseek64 whence */
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+/* the most segments of readv/writev */
+#define UIO_MAXIOV 16
+
+/* waitpid options */
+#define WNOHANG 1
+
+/* clock_gettime */
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
 
 #endif
 
@@ -44,6 +78,41 @@ extern int mkdir(const char *pathname, unsigned mode);
 extern int mount(const char *src, const char *target, const char *filesystem, unsigned long flags, const void *data);
 extern int chdir(const char *path);
 extern long lseek64(int fd, long offset, int whence);
+struct iovec{
+    void *iov_base;
+    unsigned long iov_len;
+};
+extern long readv(int fd, const struct iovec *iov, int iovcnt);
+extern long writev(int fd, const struct iovec *iov, int iovcnt);
+extern long pread64(int fd, void *buf, unsigned long count, long offset);
+extern long pwrite64(int fd, const void *buf, unsigned long count, long offset);
 extern int ioctl(int fd, unsigned long request, ...);
+extern int sched_setaffinity(int pid, unsigned int mask);
+extern int sched_getaffinity(int pid);
+struct _ThreadStat;
+extern int thread_stat(int pid, struct _ThreadStat *stat);
+
+struct timespec{
+    long tv_sec;
+    long tv_nsec;
+};
+extern int nanosleep(const struct timespec *req, struct timespec *rem);
+extern int sched_yield();
+extern int waitpid(int pid, int *status, int options);
+
+struct timeval{
+    long tv_sec;
+    long tv_usec;
+};
+struct _VdsoData;
+extern const struct _VdsoData *get_vdso_data();
+extern int settimeofday(const struct timeval *tv, const void *tz);
+extern int null_syscall();
+struct _IoRing;
+extern struct _IoRing *io_ring_setup();
+extern int io_ring_enter(struct _IoRing *ring, unsigned int to_submit);
+/* user_time.c, no syscall */
+extern int clock_gettime(int clk_id, struct timespec *tp);
+extern int gettimeofday(struct timeval *tv, void *tz);
 
 #endif  
\ No newline at end of file
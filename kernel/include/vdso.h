@@ -0,0 +1,56 @@
+#ifndef VDSO_H_
+#define VDSO_H_
+
+/*
+ * The time data shared with EL0.
+ * clock_gettime of the user library reads it and cntpct_el0 (CNTKCTL_EL1.EL0PCTEN) without a syscall,
+ * it gets the address once from VDSO_DATA. The ram is mapped EL0 RW (mmu.h), EL0 only reads it by convention.
+ * The writer makes seq odd while it updates the data, the reader retries on an odd or changed seq.
+ */
+typedef struct _VdsoData{
+    volatile unsigned int seq;
+    unsigned int reserved;
+    unsigned long long cntfrq;
+    unsigned long long boot_cnt; // cntpct at boot, CLOCK_MONOTONIC is 0 here
+    long long wall_sec; // CLOCK_REALTIME at boot_cnt
+    long long wall_nsec;
+}VdsoData;
+
+/* the reader for both EL1 and EL0 */
+static inline void vdso_read(const VdsoData *vd, int realtime, long *sec, long *nsec){
+    unsigned int seq;
+    unsigned long long frq, boot, cnt, delta;
+    long long wall_sec, wall_nsec;
+
+    do{
+        seq = vd->seq;
+        asm volatile("dmb ishld\n\t" ::: "memory");
+        frq = vd->cntfrq;
+        boot = vd->boot_cnt;
+        wall_sec = vd->wall_sec;
+        wall_nsec = vd->wall_nsec;
+        asm volatile("dmb ishld\n\t" ::: "memory");
+    }while((seq & 1) || seq != vd->seq);
+
+    asm volatile("isb\n\tmrs %0, cntpct_el0\n\t" :"=r"(cnt) ::"memory");
+    delta = cnt - boot;
+    *sec = delta / frq;
+    *nsec = (delta % frq) * 1000000000 / frq;
+    if(realtime){
+        *sec += wall_sec;
+        *nsec += wall_nsec;
+        if(*nsec >= 1000000000){
+            *nsec -= 1000000000;
+            (*sec)++;
+        }
+    }
+}
+
+extern VdsoData vdso_data;
+
+void vdso_init();
+void vdso_settime(long long, long long);
+void print_date();
+void date_arg(char *);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <list.h>
+#include <spinlock.h>
 
 enum file_type {
 	UART,
@@ -23,6 +24,8 @@ enum dentry_type {
 #define READ_ONLY 1
 #define EOF (-1)
 #define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
 
 // file handle
 typedef struct file {
@@ -65,12 +68,17 @@ typedef struct filesystem {
 	int (*setup_mount)(struct filesystem* fs, struct mount* mount);
 }FileSystem;
 
+extern Spinlock vfs_lock;
+
 struct file_operations {
 	int (*write)(struct file* file, const void* buf, size_t len);
 	int (*read)(struct file* file, void* buf, size_t len);
 	int (*open)(struct vnode* file_node, struct file** target);
 	int (*close)(struct file* file);
 	long (*lseek64)(struct file* file, long offset, int whence);
+	/* at pos without moving f_pos, NULL: not seekable (uart) */
+	int (*pread)(struct file* file, void* buf, size_t len, long pos);
+	int (*pwrite)(struct file* file, const void* buf, size_t len, long pos);
 };
 
 struct vnode_operations {
@@ -106,6 +114,9 @@ int change_global_path(Dentry *target);
 int vfs_mount(const char* pathname, const char* filesystem);
 int vfs_umount(const char *pathname);
 int vfs_mknod(const char* pathname, enum file_type type);
-int vfs_lseek64(struct file* file, long offset, int whence);
+long vfs_lseek64(struct file* file, long offset, int whence);
+int vfs_pread(struct file* file, void* buf, size_t len, long pos);
+int vfs_pwrite(struct file* file, const void* buf, size_t len, long pos);
+int vfs_is_dev(struct file* file);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef WORKQUEUE_H_
+#define WORKQUEUE_H_
+
+#include <smp.h>
+
+typedef void (*WorkFunc)(void *);
+
+/* 
+ * A deferred job, embedded in its owner so queueing never allocates.
+ * It can be queued again once its func has started.
+ */
+typedef struct _Work{
+    struct _Work *next;
+    WorkFunc func;
+    void *data;
+    volatile unsigned int pending; // 1: queued and not started yet
+    unsigned int cpu; // the queue it was queued on last
+}Work;
+
+/* 
+ * Per-cpu work queue, a lock-free list.
+ * Any cpu or irq handler pushes with ldaxr/stlxr,
+ * the worker thread of the cpu takes the whole list at once and runs it in order.
+ */
+typedef struct _WorkQueue{
+    Work *volatile head;
+    struct _Thread *volatile worker; // kworker/n, bound to cpu n
+    Work *volatile current_work; // the work running on the worker
+    unsigned long long nr_done;
+    unsigned int nr_batch; // the times the worker took the list
+    unsigned int max_batch; // the longest list taken at once
+}WorkQueue;
+
+void init_work(Work *, WorkFunc, void *);
+int queue_work(Work *);
+int queue_work_on(unsigned int, Work *);
+void flush_work(Work *);
+void workqueue_init();
+void print_workqueue();
+
+#endif
@@ -5,9 +5,12 @@
 #include <string.h>
 #include <uart.h>
 #include <cpio.h>
+#include <spinlock.h>
 
 Frame *frames;
 Buddy *buddy_list;
+/* protect buddy_list and frames */
+Spinlock buddy_lock;
 // Frame frames[FRAME_NUM];
 // Buddy buddy_list[MAX_BUDDY_ORDER+1];
 
@@ -19,6 +22,7 @@ extern unsigned long long CPIO_BASE_END;
 extern FreeChunkList *freechunk_list;
 
 void all_allocator_init(){
+    spin_lock_init(&buddy_lock, "buddy_lock");
     startup_alloc();
     freechunk_list_init();
     frames_init();
@@ -134,9 +138,11 @@ void buddy_init(){
 void *buddy_alloc(unsigned int size){
     unsigned int use_frames = (size % FRAME_SIZE == 0) ? (size / FRAME_SIZE) : (size / FRAME_SIZE) + 1;
     int use_order = (int)log2(use_frames);
+    unsigned long flags = spin_lock_irqsave(&buddy_lock);
     for(unsigned int i = use_order; i <= MAX_BUDDY_ORDER; i++){
         if(!list_empty(&buddy_list[i].list)){
             Frame *alloca_frame = (Frame *)buddy_pop(&buddy_list[i], use_order);
+            spin_unlock_irqrestore(&buddy_lock, flags);
             unsigned long long alloca_addr = alloca_frame->idx * FRAME_SIZE + BUDDY_ADDR_START;
             // print_use_frame(size, alloca_frame->idx, use_frames, use_order);
             // print_buddy_list();
@@ -144,6 +150,7 @@ void *buddy_alloc(unsigned int size){
             return (void *)alloca_addr;
         }
     }
+    spin_unlock_irqrestore(&buddy_lock, flags);
     print_string(UITOHEX, "[x] Allocate Size: 0x", size, 1);
     uart_puts("[x] No enough memory!!!!\n");
     // print_string(UITOHEX, "[*] No enough memory!!!!", left_frame->idx, 0);
@@ -189,6 +196,13 @@ int addr_to_frame_idx(void *addr){
 }
 
 void buddy_free(void *addr){
+    unsigned long flags = spin_lock_irqsave(&buddy_lock);
+    __buddy_free(addr);
+    spin_unlock_irqrestore(&buddy_lock, flags);
+}
+
+/* the caller should hold buddy_lock */
+void __buddy_free(void *addr){
     unsigned int idx = addr_to_frame_idx(addr);
     Frame *target_frame = &frames[idx];
     Frame *buddy_frame  = find_buddy_frame(target_frame, target_frame->order);
@@ -4,6 +4,7 @@
 #include <mailbox.h>
 #include <malloc.h>
 #include <tmpfs.h>
+#include <mmu.h>
 
 struct file_operations* uart_file_ops;
 struct file_operations* framebuffer_file_ops;
@@ -18,12 +19,16 @@ void dev_ops_init(){
     uart_file_ops->open = tmpfs_open;
     uart_file_ops->lseek64 = tmpfs_lseek64;
     uart_file_ops->close = tmpfs_close;
+    uart_file_ops->pread = NULL;
+    uart_file_ops->pwrite = NULL;
 
     framebuffer_file_ops = (struct file_operations*)kmalloc(sizeof(struct file_operations));
     framebuffer_file_ops->write = framebuf_dev_write;
     framebuffer_file_ops->open = tmpfs_open;
     framebuffer_file_ops->lseek64 = tmpfs_lseek64;
     framebuffer_file_ops->close = tmpfs_close;
+    framebuffer_file_ops->pread = NULL;
+    framebuffer_file_ops->pwrite = framebuf_dev_pwrite;
 }
 
 
@@ -33,13 +38,28 @@ int uart_dev_read(struct file* file, void* buf, size_t len){
 }
 
 int uart_dev_write(struct file* file, const void* buf, size_t len){
-    uart_nbyte((char *)buf, len);
-    return len;
+    return async_uart_write((const char *)buf, len, 1);
+}
+
+/* the write must be inside the framebuffer, pitch * height bytes */
+static int framebuf_in_range(size_t pos, size_t len){
+    size_t size = (size_t)pitch * height;
+    return lfb != NULL && pos <= size && len <= size - pos;
 }
 
 int framebuf_dev_write(struct file* file, const void* buf, size_t len){
     size_t pos = file->f_pos;
+    if(!framebuf_in_range(pos, len)) return -1;
     memcpy((char *)lfb + pos, buf, len);
+    /* the GPU scans out the ram */
+    dcache_clean_range((char *)lfb + pos, len);
     file->f_pos += len;
     return len;
 }
+
+int framebuf_dev_pwrite(struct file* file, const void* buf, size_t len, long pos){
+    if(pos < 0 || !framebuf_in_range(pos, len)) return -1;
+    memcpy((char *)lfb + pos, buf, len);
+    dcache_clean_range((char *)lfb + pos, len);
+    return len;
+}
@@ -3,11 +3,15 @@
 #include <exc.h>
 #include <syscall.h>
 #include <user_syscall.h>
+#include <fpsimd.h>
+#include <sched.h>
+#include <irq.h>
 
 void exception_handler( unsigned long long esr, 
                         unsigned long long elr, 
                         unsigned long long spsr,
-                        TrapFrame *trapFrame){
+                        TrapFrame *trapFrame,
+                        unsigned long long stamp){
 
     /* 
      * EC, bits [31:26] -> Exception Class. Indicates the reason for the exception that this register holds information about.
@@ -15,85 +19,72 @@ void exception_handler( unsigned long long esr,
      * https://developer.arm.com/documentation/ddi0601/2021-12/AArch64-Registers/ESR-EL1--Exception-Syndrome-Register--EL1-?lang=en
     */
     unsigned int ec = esr >> 26;
+    trace_irq_entry(spsr, stamp);
+    account_exc_enter(spsr);
     if(ec == 0b010101){
         unsigned int syscall_id = trapFrame->x[8];
         syscall_handler(syscall_id, trapFrame);
     }
+    else if(ec == EC_FPSIMD_ACC){
+        fpsimd_acc_handler();
+    }
     else{
         uart_puts("---------Exception Handler---------\n[*] Exception type: Synchronous\n");
         print_string(UITOHEX, "[*] spsr_el1: 0x", spsr, 1);
         print_string(UITOHEX, "[*] elr_el1: 0x", elr, 1);
         print_string(UITOHEX, "[*] esr_el1: 0x", esr, 1);
     }
-
+    account_cpu_time(ACCT_SYS);
+    trace_irq_exit(trapFrame->spsr_el1);
 }
 
 
-void syscall_handler(unsigned int syscall_id, TrapFrame *trapFrame){
-    switch (syscall_id)
-    {
-    case GET_PID:
-        sys_getpid(trapFrame);
-        break;
-    case UART_READ:
-        sys_uart_read(trapFrame);
-        break;
-    case UART_WRITE:
-        sys_uart_write(trapFrame);
-        break;
-    case EXEC:
-        sys_exec(trapFrame);
-        break;
-    case FORK:
-        sys_fork(trapFrame);
-        break;
-    case EXIT:
-        sys_exit(trapFrame);
-        break;
-    case MBOX_CALL:
-        sys_mbox_call(trapFrame);
-        break;
-    case KILL:
-        sys_kill(trapFrame);
-        break;
-    case SIGNAL_:
-        sys_signal_register(trapFrame);
-        break;
-    case SIGKILL:
-        sys_signal_kill(trapFrame);
-        break;
-    case SIGRETURN:
-        sys_sigreturn(trapFrame);
-        break;
-    case OPEN:
-        sys_open(trapFrame);
-        break;
-    case CLOSE:
-        sys_close(trapFrame);
-        break;
-    case WRITE:
-        sys_write(trapFrame);
-        break;
-    case READ:
-        sys_read(trapFrame);
-        break;
-    case MKDIR:
-        sys_mkdir(trapFrame);
-        break;
-    case MOUNT:
-        sys_mount(trapFrame);
-        break;
-    case CHDIR:
-        sys_chdir(trapFrame);
-        break;
-    case LSEEK64:
-        sys_lseek64(trapFrame);
-        break;
-    case IOCTL:
-        sys_ioctl(trapFrame);
-        break;
+typedef void (*SyscallFunc)(TrapFrame *);
 
-    default:
-        break;
+/* GET_PID also has the fast path in start.S, it doesn't come here from el0 */
+static const SyscallFunc syscall_table[NR_SYSCALLS] = {
+    [GET_PID] = sys_getpid,
+    [UART_READ] = sys_uart_read,
+    [UART_WRITE] = sys_uart_write,
+    [EXEC] = sys_exec,
+    [FORK] = sys_fork,
+    [EXIT] = sys_exit,
+    [MBOX_CALL] = sys_mbox_call,
+    [KILL] = sys_kill,
+    [SIGNAL_] = sys_signal_register,
+    [SIGKILL] = sys_signal_kill,
+    [SIGRETURN] = sys_sigreturn,
+    [OPEN] = sys_open,
+    [CLOSE] = sys_close,
+    [WRITE] = sys_write,
+    [READ] = sys_read,
+    [MKDIR] = sys_mkdir,
+    [MOUNT] = sys_mount,
+    [CHDIR] = sys_chdir,
+    [LSEEK64] = sys_lseek64,
+    [IOCTL] = sys_ioctl,
+    [SCHED_SETAFFINITY] = sys_sched_setaffinity,
+    [SCHED_GETAFFINITY] = sys_sched_getaffinity,
+    [THREAD_STAT] = sys_thread_stat,
+    [NANOSLEEP] = sys_nanosleep,
+    [SCHED_YIELD] = sys_sched_yield,
+    [WAITPID] = sys_waitpid,
+    [VDSO_DATA] = sys_vdso_data,
+    [SETTIMEOFDAY] = sys_settimeofday,
+    [NULL_SYSCALL] = sys_null,
+    [IO_RING_SETUP] = sys_io_ring_setup,
+    [IO_RING_ENTER] = sys_io_ring_enter,
+    [READV] = sys_readv,
+    [WRITEV] = sys_writev,
+    [PREAD64] = sys_pread64,
+    [PWRITE64] = sys_pwrite64,
+};
+
+/* the unknown syscall number returns -1 */
+void syscall_handler(unsigned int syscall_id, TrapFrame *trapFrame){
+    if(syscall_id >= NR_SYSCALLS || syscall_table[syscall_id] == NULL){
+        trapFrame->x[0] = -1;
+        return;
     }
+    syscall_table[syscall_id](trapFrame);
 }
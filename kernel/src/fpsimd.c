@@ -0,0 +1,69 @@
+#include <fpsimd.h>
+#include <sched.h>
+#include <smp.h>
+#include <string.h>
+
+/*
+ * Lazy FP/SIMD switching
+ * A thread's FP/SIMD registers are only live on the cpu it used them last (cpu->fpsimd_last).
+ * After a switch the access from EL0 traps, then the registers are loaded.
+ * Only the thread that used FP/SIMD in its time slice is saved when it is switched out.
+ */
+
+/*
+ * Called in schedule before cpu_switch_to, the irq is disabled.
+ */
+void fpsimd_thread_switch(Thread *prev, Thread *next){
+    Cpu *cpu = get_cpu();
+
+    /* prev used FP/SIMD in this time slice, the registers are newer than prev->fpsimd */
+    if(fpsimd_enabled()){
+        fpsimd_save_state(&prev->fpsimd);
+        cpu->nr_fpsimd_save++;
+    }
+
+    /* the registers still hold the state of next, don't trap */
+    if(cpu->fpsimd_last == next && next->fpsimd_cpu == cpu->id)
+        fpsimd_set_trap(CPACR_FPEN_NO_TRAP);
+    else
+        fpsimd_set_trap(CPACR_FPEN_TRAP_EL0);
+}
+
+/* the first FP/SIMD access of the current thread after the switch */
+void fpsimd_acc_handler(){
+    Thread *curr_thread = get_current();
+    Cpu *cpu = get_cpu();
+
+    if(!(cpu->fpsimd_last == curr_thread && curr_thread->fpsimd_cpu == cpu->id)){
+        /* never used, don't leak the registers of another thread */
+        if(!curr_thread->used_fpsimd)
+            memset((char *)&curr_thread->fpsimd, 0, sizeof(FpsimdState));
+        fpsimd_load_state(&curr_thread->fpsimd);
+        cpu->fpsimd_last = curr_thread;
+        curr_thread->fpsimd_cpu = cpu->id;
+        cpu->nr_fpsimd_load++;
+    }
+    curr_thread->used_fpsimd = 1;
+    fpsimd_set_trap(CPACR_FPEN_NO_TRAP);
+}
+
+/* exec: the new program starts with the zero FP/SIMD state */
+void fpsimd_flush_thread(Thread *thread){
+    unsigned long flags = local_irq_save();
+    thread->used_fpsimd = 0;
+    thread->fpsimd_cpu = -1;
+    if(thread == get_current())
+        fpsimd_set_trap(CPACR_FPEN_TRAP_EL0);
+    local_irq_restore(flags);
+}
+
+/* fork: the child gets a copy of the parent's FP/SIMD state */
+void fpsimd_fork(Thread *parent, Thread *child){
+    unsigned long flags = local_irq_save();
+    if(parent == get_current() && fpsimd_enabled())
+        fpsimd_save_state(&parent->fpsimd);
+    memcpy((char *)&child->fpsimd, (char *)&parent->fpsimd, sizeof(FpsimdState));
+    child->used_fpsimd = parent->used_fpsimd;
+    child->fpsimd_cpu = -1;
+    local_irq_restore(flags);
+}
@@ -0,0 +1,96 @@
+#include <io_ring.h>
+#include <sched.h>
+#include <syscall.h>
+#include <malloc.h>
+#include <string.h>
+#include <stddef.h>
+
+/* the ring is only used by the thread that set it up, the fork child calls IO_RING_SETUP itself */
+IoRing *do_io_ring_setup(){
+    Thread *current = get_current();
+    if(current->io_ring != NULL)
+        return current->io_ring;
+
+    IoRing *ring = (IoRing *)kmalloc(sizeof(IoRing));
+    if(ring == NULL)
+        return NULL;
+    memset((char *)ring, 0, sizeof(IoRing));
+    ring->entries = IO_RING_ENTRIES;
+    current->io_ring = ring;
+    return ring;
+}
+
+/* exec and reap_thread, the new program or thread sets up its own */
+void io_ring_free(Thread *thread){
+    if(thread->io_ring == NULL)
+        return;
+    kfree(thread->io_ring);
+    thread->io_ring = NULL;
+}
+
+/* the same path as the syscall of the op, -1 for the bad fd */
+static long io_ring_run(const IoRingSqe *sqe, int fd){
+    switch(sqe->opcode){
+        case IO_RING_OP_NOP:
+            return 0;
+        case IO_RING_OP_OPEN:
+            return do_open((const char *)sqe->addr, sqe->len);
+        case IO_RING_OP_CLOSE:
+            return do_close(fd);
+        case IO_RING_OP_READ:
+            return do_read(fd, (char *)sqe->addr, sqe->len);
+        case IO_RING_OP_WRITE:
+            return do_write(fd, (const char *)sqe->addr, sqe->len);
+        case IO_RING_OP_LSEEK64:
+            return do_lseek64(fd, sqe->off, sqe->len);
+    }
+    return -1;
+}
+
+/*
+ * Run the sqes in order, stop after to_submit of them or when the cq is full.
+ * The reads and writes of the uart may sleep like the syscalls, the ring itself has no lock:
+ * only the owner thread enters it.
+ */
+int do_io_ring_enter(IoRing *ring, unsigned int to_submit){
+    if(ring == NULL || ring != get_current()->io_ring)
+        return -1;
+
+    /* EL0 may write any field, the bounds come from IO_RING_ENTRIES only, entries is informational */
+    unsigned int head = ring->sq_head;
+    unsigned int tail = ring->sq_tail;
+    if(tail - head > IO_RING_ENTRIES)
+        return -1;
+    /* the sqes are written before sq_tail */
+    asm volatile("dmb ishld\n\t" ::: "memory");
+
+    const unsigned int mask = IO_RING_ENTRIES - 1;
+    int last_fd = -1;
+    unsigned int submitted = 0;
+    while(head != tail && submitted < to_submit){
+        /* no room for the cqe, the rest waits for the next enter */
+        if(ring->cq_tail - ring->cq_head >= IO_RING_ENTRIES)
+            break;
+        /* the user may reuse the slot once sq_head moves */
+        IoRingSqe sqe = ring->sqes[head & mask];
+        ring->sq_head = ++head;
+        submitted++;
+
+        if(sqe.opcode > IO_RING_OP_LSEEK64){
+            ring->dropped++;
+            continue;
+        }
+        int fd = sqe.fd == IO_RING_FD_LAST ? last_fd : sqe.fd;
+        long res = io_ring_run(&sqe, fd);
+        if(sqe.opcode == IO_RING_OP_OPEN && res >= 0)
+            last_fd = res;
+
+        IoRingCqe *cqe = &ring->cqes[ring->cq_tail & mask];
+        cqe->user_data = sqe.user_data;
+        cqe->res = res;
+        /* the cqe is written before cq_tail */
+        asm volatile("dmb ishst\n\t" ::: "memory");
+        ring->cq_tail = ring->cq_tail + 1;
+    }
+    return submitted;
+}
@@ -1,27 +1,220 @@
 #include <irq.h>
 #include <timer.h>
-#include <task.h>
+#include <softirq.h>
 #include <uart.h>
 #include <string.h>
 #include <sched.h>
 #include <signal.h>
 #include <syscall.h>
+#include <smp.h>
 
-extern Thread *run_thread_head;
 
-void irq_handler(unsigned long long spsr, TrapFrame *trapFrame){     
+extern Cpu cpus[NR_CPUS];
+
+static IrqDesc irq_descs[NR_IRQS];
+static Spinlock irq_desc_lock;
+static unsigned long long nr_spurious[NR_CPUS];
+static unsigned long long irqoff_hist[NR_CPUS][IRQ_HIST_BUCKETS];
+static unsigned long long irq_lat_hist[NR_CPUS][IRQ_HIST_BUCKETS];
+/* tpidr_el1 of core 0 is set, irq_init is called after smp_init_boot_cpu */
+static volatile int irqoff_trace_ready = 0;
+
+static inline unsigned long long read_cntpct(){
+    unsigned long long cnt;
+    asm volatile("mrs %0, cntpct_el0\n\t" :"=r"(cnt));
+    return cnt;
+}
+
+void irq_init(){
+    spin_lock_init(&irq_desc_lock, "irq_desc_lock");
+    request_irq(IRQ_CNTPNS, Time_interrupt, "timer", NULL);
+    irqoff_trace_ready = 1;
+}
+
+static inline unsigned int hist_bucket(unsigned long long ticks){
+    unsigned int bucket = ticks ? 64 - __builtin_clzll(ticks) : 0;
+    return bucket < IRQ_HIST_BUCKETS ? bucket : IRQ_HIST_BUCKETS - 1;
+}
+
+/* the irq of this cpu is being masked */
+void trace_irq_off(){
+    if(!irqoff_trace_ready) return;
+    Cpu *cpu = get_cpu();
+    if(cpu->irqoff_start == 0)
+        cpu->irqoff_start = read_cntpct();
+}
+
+/* the irq of this cpu is about to be unmasked, called with it still masked */
+void trace_irq_on(){
+    if(!irqoff_trace_ready) return;
+    Cpu *cpu = get_cpu();
+    if(cpu->irqoff_start == 0) return;
+    unsigned long long ticks = read_cntpct() - cpu->irqoff_start;
+    cpu->irqoff_start = 0;
+    irqoff_hist[cpu->id][hist_bucket(ticks)]++;
+    if(ticks > cpu->irqoff_max) cpu->irqoff_max = ticks;
+}
+
+/* 
+ * The exception masked the irq at stamp (cntpct in start.S).
+ * EL0 always runs with the irq unmasked, a region still open on an entry from EL0
+ * was closed by an eret without trace_irq_exit (ret_from_fork), drop it.
+ */
+void trace_irq_entry(unsigned long long spsr, unsigned long long stamp){
+    if(!irqoff_trace_ready) return;
+    Cpu *cpu = get_cpu();
+    if((spsr & 0xf) == 0) cpu->irqoff_start = 0;
+    if(cpu->irqoff_start == 0) cpu->irqoff_start = stamp;
+}
+
+/* the eret restores spsr, the region ends if it unmasks the irq */
+void trace_irq_exit(unsigned long long spsr){
+    if(!(spsr & DAIF_I)) trace_irq_on();
+}
+
+/* the timer irq is late by the time from its deadline to irq_entry */
+static void irq_latency_update(unsigned long long stamp){
+    unsigned long long cval;
+    asm volatile("mrs %0, cntp_cval_el0\n\t" :"=r"(cval));
+    if(stamp < cval) return;
+    Cpu *cpu = get_cpu();
+    unsigned long long ticks = stamp - cval;
+    irq_lat_hist[cpu->id][hist_bucket(ticks)]++;
+    if(ticks > cpu->irq_lat_max) cpu->irq_lat_max = ticks;
+}
+
+/* 
+ * Install the handler of irq, and unmask it on the interrupt controller if it is a GPU irq.
+ * The core local sources are unmasked by their drivers (enable_timer_irq).
+ * Return -1 if the irq is invalid or taken.
+ */
+int request_irq(unsigned int irq, IrqHandler handler, const char *name, void *dev_id){
+    if(irq >= NR_IRQS || handler == NULL) return -1;
+    unsigned long flags = spin_lock_irqsave(&irq_desc_lock);
+    IrqDesc *desc = &irq_descs[irq];
+    if(desc->handler != NULL){
+        spin_unlock_irqrestore(&irq_desc_lock, flags);
+        return -1;
+    }
+    desc->dev_id = dev_id;
+    desc->name = name;
+    asm volatile("dmb ish\n\t" ::: "memory");
+    desc->handler = handler;
+    if(irq < 32)
+        *ENABLE_IRQS_1 = 1 << irq;
+    else if(irq < NR_GPU_IRQS)
+        *ENABLE_IRQS_2 = 1 << (irq - 32);
+    spin_unlock_irqrestore(&irq_desc_lock, flags);
+    return 0;
+}
+
+/* mask the GPU irq and remove the handler, the stat is kept */
+void free_irq(unsigned int irq, void *dev_id){
+    if(irq >= NR_IRQS) return;
+    unsigned long flags = spin_lock_irqsave(&irq_desc_lock);
+    IrqDesc *desc = &irq_descs[irq];
+    if(desc->handler != NULL && desc->dev_id == dev_id){
+        if(irq < 32)
+            *DISABLE_IRQS_1 = 1 << irq;
+        else if(irq < NR_GPU_IRQS)
+            *DISABLE_IRQS_2 = 1 << (irq - 32);
+        desc->handler = NULL;
+        desc->dev_id = NULL;
+    }
+    spin_unlock_irqrestore(&irq_desc_lock, flags);
+}
+
+/* run the handler of irq without irq_desc_lock, free_irq doesn't wait for it */
+static void handle_irq(unsigned int irq){
+    IrqDesc *desc = &irq_descs[irq];
+    unsigned int cpu = smp_processor_id();
+    IrqHandler handler = desc->handler;
+    if(handler == NULL){
+        nr_spurious[cpu]++;
+        return;
+    }
+    unsigned long long start = read_cntpct();
+    handler(irq, desc->dev_id);
+    desc->time[cpu] += read_cntpct() - start;
+    desc->count[cpu]++;
+}
+
+/* the GPU interrupts are routed to core 0 only, dispatch every pending bit of the two banks */
+static void handle_gpu_irq(){
+    unsigned int pending = *IRQ_PENDING_1;
+    while(pending){
+        unsigned int bit = __builtin_ctz(pending);
+        pending &= pending - 1;
+        handle_irq(bit);
+    }
+    pending = *IRQ_PENDING_2;
+    while(pending){
+        unsigned int bit = __builtin_ctz(pending);
+        pending &= pending - 1;
+        handle_irq(32 + bit);
+    }
+}
+
+void irq_handler(unsigned long long spsr, TrapFrame *trapFrame, unsigned long long stamp){     
     // uart_sputs("---------IRQ Handler---------\n");
-    if(*CORE0_IRQ_SOURCE & 0x2) Time_interrupt(spsr);
-    else if(*CORE0_IRQ_SOURCE & 0x100) GPU_interrupt();
+    unsigned int source = *CORE_IRQ_SOURCE(smp_processor_id()) & ((1 << NR_LOCAL_IRQS) - 1);
+    trace_irq_entry(spsr, stamp);
+    /* before Time_interrupt moves cntp_cval_el0 */
+    if(source & (1 << (IRQ_CNTPNS - IRQ_LOCAL_BASE)))
+        irq_latency_update(stamp);
+    account_exc_enter(spsr);
+    irq_enter();
+    while(source){
+        unsigned int bit = __builtin_ctz(source);
+        source &= source - 1;
+        if(bit == LOCAL_IRQ_GPU)
+            handle_gpu_irq();
+        else
+            handle_irq(IRQ_LOCAL(bit));
+    }
+    account_cpu_time(ACCT_IRQ);
+    irq_exit();
 
     /* check the spsr if it is from user mode */
     spsr &= 0b1111;
     if(spsr == 0x0){
         check_sig_queue(trapFrame);
     } 
+    trace_irq_exit(trapFrame->spsr_el1);
 }
 
-void Time_interrupt(unsigned long long spsr){
+void print_irqs(){
+    unsigned long long frq;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+    uart_puts("-------------------------- IRQs --------------------------\n");
+    for(unsigned int irq = 0; irq < NR_IRQS; irq++){
+        IrqDesc *desc = &irq_descs[irq];
+        unsigned long long count = 0, time = 0;
+        for(unsigned int cpu = 0; cpu < NR_CPUS; cpu++){
+            count += desc->count[cpu];
+            time += desc->time[cpu];
+        }
+        if(desc->handler == NULL && count == 0) continue;
+        print_string(UITOA, "[", irq, 0);
+        uart_puts("] ");
+        uart_puts(desc->handler != NULL ? (char *)desc->name : "(freed)");
+        for(unsigned int cpu = 0; cpu < NR_CPUS; cpu++){
+            print_string(UITOA, " | cpu", cpu, 0);
+            print_string(UITOA, ": ", desc->count[cpu], 0);
+        }
+        print_string(UITOA, " | time(us): ", time * 1000000 / frq, 0);
+        print_string(UITOA, " | avg(ns): ", count ? time / count * 1000000000 / frq : 0, 1);
+    }
+    uart_puts("spurious");
+    for(unsigned int cpu = 0; cpu < NR_CPUS; cpu++){
+        print_string(UITOA, " | cpu", cpu, 0);
+        print_string(UITOA, ": ", nr_spurious[cpu], 0);
+    }
+    uart_puts("\n");
+}
+
+/* IRQ_CNTPNS of every core */
+void Time_interrupt(unsigned int irq, void *dev_id){
     // unsigned long long frq = 0;
     // asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
     // print_string(UITOHEX, "spsr = ", (unsigned long long)spsr, 1);
@@ -36,61 +229,27 @@ void Time_interrupt(unsigned long long spsr){
         // disable_timer_irq();
         // add_task(timer_interrupt_handler, 1);
         // do_task();
-        timer_interrupt_handler();
-        Thread *next = (Thread *)run_thread_head->list.next;
-        if((Thread *)next->list.next != run_thread_head){
+        /* the top half, TIMER_SOFTIRQ runs the expired timers and programs the next one */
+        set_long_timer_irq();
+        raise_softirq(TIMER_SOFTIRQ);
+        raise_softirq(SCHED_SOFTIRQ);
+        /* the scheduler tick, the current thread is scheduled out on irq_exit */
+        Cpu *cpu = get_cpu();
+        if(!list_empty(&cpu->rq)){
             //uart_puts("go to schedule\n");
-            schedule();
+            set_need_resched();
         }
         
     // }
 }
 
 
-/* 
-    AUX_MU_IIR:
-    On read this register shows the interrupt ID bit Interrupt ID
-    bit[2:1]
-    00 : No interrupts
-    01 : Transmit holding register empty
-    10 : Receiver holds valid byte
-    11 : <Not possible>
-
-    AUX_MU_IER_REG:
-    bit 1: Enable Transmit interrupt
-    bit 0: Enable Receive interrupt
-*/
-
-
-void GPU_interrupt(){
-    // uart_sputs("GPU interrupt\n");
-    if(*AUX_MU_IIR & TRANSMIT_HOLDING){ // Transmit interrupt
-        // disable_AUX_MU_IER_w();
-        // add_task(tran_interrupt_handler, 3);
-        // do_task();
-        tran_interrupt_handler();
-        enable_irq();
-    }
-    else if(*AUX_MU_IIR & RECEIVE_VALID){ // Receive interrupt
-        // disable_AUX_MU_IER_r();
-        // disable_AUX_MU_IER_w();
-        // add_task(recv_interrupt_handler, 2);
-        // do_task();
-        recv_interrupt_handler();
-        enable_irq();
-    }
-    else{
-        uart_puts("[*] AUX_MU_IIR: No interrupts\n");
-    }
-}
-
-
 void enable_timer_irq(){
     asm volatile(
         "msr cntp_ctl_el0, %0\n\t"
         ::"r"(1)
     );
-    *CORE0_TIMER_IRQ_CTRL |= 2;
+    *CORE_TIMER_IRQ_CTRL(smp_processor_id()) |= 2;
 }
 
 void disable_timer_irq(){
@@ -98,7 +257,7 @@ void disable_timer_irq(){
         "msr cntp_ctl_el0, %0\n\t"
         ::"r"(0)
     );
-    *CORE0_TIMER_IRQ_CTRL &= ~2;
+    *CORE_TIMER_IRQ_CTRL(smp_processor_id()) &= ~2;
 }
 
 void reset_timer_irq(unsigned long long expired_time){
@@ -127,10 +286,47 @@ void set_period_timer_irq(unsigned long long peried){
 }
 
 void enable_irq(){
+#if IRQOFF_TRACE
+    if(irqs_disabled()) trace_irq_on();
+#endif
     asm volatile("msr DAIFClr, 0xf");
 }
 
 void disable_irq(){
+#if IRQOFF_TRACE
+    int was_enabled = !irqs_disabled();
+#endif
     asm volatile("msr DAIFSet, 0xf");
+#if IRQOFF_TRACE
+    if(was_enabled) trace_irq_off();
+#endif
+}
+
+static void print_hist(const char *title, unsigned long long hist[NR_CPUS][IRQ_HIST_BUCKETS],
+                        unsigned long long frq){
+    uart_puts((char *)title);
+    uart_puts("\n");
+    for(unsigned int b = 0; b < IRQ_HIST_BUCKETS; b++){
+        unsigned long long count = 0;
+        for(unsigned int cpu = 0; cpu < NR_CPUS; cpu++)
+            count += hist[cpu][b];
+        if(count == 0) continue;
+        if(b == IRQ_HIST_BUCKETS - 1)
+            print_string(UITOA, "  >= ", (1ULL << (b - 1)) * 1000000000 / frq, 0);
+        else
+            print_string(UITOA, "  < ", (1ULL << b) * 1000000000 / frq, 0);
+        print_string(UITOA, " ns: ", count, 1);
+    }
 }
 
+void print_irq_hist(){
+    unsigned long long frq;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+    print_hist("---------- timer irq latency (cntp_cval_el0 to irq_entry) ----------", irq_lat_hist, frq);
+    print_hist("---------- irq-masked regions ----------", irqoff_hist, frq);
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        print_string(UITOA, "cpu", i, 0);
+        print_string(UITOA, " | max latency(us): ", cpus[i].irq_lat_max * 1000000 / frq, 0);
+        print_string(UITOA, " | max irq-off(us): ", cpus[i].irqoff_max * 1000000 / frq, 1);
+    }
+}
@@ -0,0 +1,142 @@
+#include <kprintf.h>
+#include <stddef.h>
+#include <string.h>
+#include <uart.h>
+
+/* the digits of num from the end of the buffer, return the first one */
+static char *kfmt_num(char *end, unsigned long long num, unsigned int base, int upper){
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do{
+        *--end = digits[num % base];
+    }while((num /= base) > 0);
+    return end;
+}
+
+/* store c if it fits, count it anyway */
+#define KFMT_PUT(c) do{ if(pos + 1 < size) buf[pos] = (c); pos++; }while(0)
+
+int kvsnprintf(char *buf, unsigned long size, const char *fmt, va_list args){
+    unsigned long pos = 0;
+    for(; *fmt; fmt++){
+        if(*fmt != '%'){
+            KFMT_PUT(*fmt);
+            continue;
+        }
+        fmt++;
+
+        /* flags, width and length */
+        int left = 0, zero = 0;
+        for(;; fmt++){
+            if(*fmt == '-') left = 1;
+            else if(*fmt == '0') zero = 1;
+            else break;
+        }
+        unsigned int width = 0;
+        if(*fmt == '*'){
+            int w = va_arg(args, int);
+            if(w < 0){
+                left = 1;
+                w = -w;
+            }
+            width = w;
+            fmt++;
+        }
+        else{
+            while(*fmt >= '0' && *fmt <= '9')
+                width = width * 10 + (*fmt++ - '0');
+        }
+        int lng = 0;
+        while(*fmt == 'l'){
+            lng++;
+            fmt++;
+        }
+        if(*fmt == 'z'){
+            lng = 1;
+            fmt++;
+        }
+
+        char tmp[24]; // 2^64 has 20 digits
+        char *end = tmp + sizeof(tmp);
+        const char *s = end;
+        const char *prefix = "";
+        unsigned long long num;
+        switch(*fmt){
+            case 'd':
+            case 'i':{
+                long long v = lng ? va_arg(args, long) : va_arg(args, int);
+                num = v < 0 ? -(unsigned long long)v : (unsigned long long)v;
+                if(v < 0) prefix = "-";
+                s = kfmt_num(end, num, 10, 0);
+                break;
+            }
+            case 'u':
+                num = lng ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+                s = kfmt_num(end, num, 10, 0);
+                break;
+            case 'x':
+            case 'X':
+                num = lng ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+                s = kfmt_num(end, num, 16, *fmt == 'X');
+                break;
+            case 'p':
+                num = (unsigned long)va_arg(args, void *);
+                prefix = "0x";
+                s = kfmt_num(end, num, 16, 0);
+                break;
+            case 's':
+                s = va_arg(args, const char *);
+                if(s == NULL) s = "(null)";
+                end = (char *)s + strlen(s);
+                zero = 0;
+                break;
+            case 'c':
+                tmp[0] = (char)va_arg(args, int);
+                s = tmp;
+                end = tmp + 1;
+                zero = 0;
+                break;
+            case '%':
+                KFMT_PUT('%');
+                continue;
+            case '\0':
+                /* a '%' at the end */
+                fmt--;
+                continue;
+            default:
+                KFMT_PUT('%');
+                KFMT_PUT(*fmt);
+                continue;
+        }
+
+        unsigned int len = end - s + strlen(prefix);
+        unsigned int pad = width > len ? width - len : 0;
+        if(!left && !zero)
+            for(; pad; pad--) KFMT_PUT(' ');
+        for(; *prefix; prefix++) KFMT_PUT(*prefix);
+        if(!left)
+            for(; pad; pad--) KFMT_PUT('0');
+        for(; s < end; s++) KFMT_PUT(*s);
+        for(; pad; pad--) KFMT_PUT(' ');
+    }
+    if(size) buf[pos < size ? pos : size - 1] = '\0';
+    return pos;
+}
+
+int ksnprintf(char *buf, unsigned long size, const char *fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
+
+/* the longer line is cut at MAX_SIZE */
+int kprintf(const char *fmt, ...){
+    char buf[MAX_SIZE];
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    uart_nbyte(buf, len < sizeof(buf) ? len : sizeof(buf) - 1);
+    return len;
+}
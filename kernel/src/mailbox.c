@@ -1,10 +1,13 @@
 #include <mailbox.h>
 #include <uart.h>
 #include <string.h>
+#include <spinlock.h>
+#include <mmu.h>
 
 unsigned int __attribute__((aligned(16))) framebuf_mbox[36];
 unsigned int width, height, pitch, isrgb; /* dimensions and channel order */
 unsigned char *lfb;                       /* raw frame buffer address */
+Spinlock mbox_lock; /* one request in the mailbox at a time */
 
 unsigned int get_board_revision(unsigned int mbox[36]){
   mbox[0] = 7 * 4; // buffer size in bytes
@@ -36,7 +39,24 @@ unsigned int get_arm_memory(unsigned int mbox[36]){
 
 }
 
+unsigned int set_clock_rate(unsigned int mbox[36], unsigned int clock_id, unsigned int rate){
+  mbox[0] = 9 * 4; // buffer size in bytes
+  mbox[1] = REQUEST_CODE;
+  // tags begin
+  mbox[2] = SET_CLOCK_RATE; // tag identifier
+  mbox[3] = 12; // maximum of request and response value buffer's length.
+  mbox[4] = TAG_REQUEST_CODE;
+  mbox[5] = clock_id;
+  mbox[6] = rate; // rate in hz
+  mbox[7] = 0; // skip setting turbo
+  // tags end
+  mbox[8] = END_TAG;
+
+  return mailbox_call(mbox, MAILBOX_CH_PROP);
+}
+
 void framebuffer_init(){
+  spin_lock_init(&mbox_lock, "mbox_lock");
   framebuf_mbox[0] = 35 * 4;
   framebuf_mbox[1] = MBOX_REQUEST;
 
@@ -106,6 +126,9 @@ void framebuffer_init(){
 unsigned int mailbox_call(unsigned int *mbox, unsigned char ch){
   /* Combine the message address (upper 28 bits) with channel number (lower 4 bits) */
   unsigned int req = (((unsigned int)((unsigned long)mbox) & (~0xF)) | (ch & 0xF));
+  spin_lock(&mbox_lock);
+  /* the GPU reads and writes the buffer in the ram, not through the cache of the core */
+  dcache_clean_inval_range(mbox, mbox[0]);
   /* wait until we can write to the mailbox */
   while(*MAILBOX_STATUS1 & MAILBOX_FULL){asm volatile("nop");}
   *MAILBOX_WRITE = req;
@@ -117,8 +140,11 @@ unsigned int mailbox_call(unsigned int *mbox, unsigned char ch){
 
     /* read the response to compare the our req and request_code */
     if(req == *MAILBOX_READ){
+      dcache_clean_inval_range(mbox, mbox[0]);
+      spin_unlock(&mbox_lock);
       return mbox[1] == MAILBOX_RESPONSE;
     }
   }
+  spin_unlock(&mbox_lock);
   return 0;
 }
\ No newline at end of file
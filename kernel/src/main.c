@@ -6,18 +6,30 @@
 #include <fdt.h>
 #include <irq.h>
 #include <allocator.h>
-#include <task.h>
+#include <softirq.h>
 #include <sched.h>
 #include <syscall.h>
 #include <vfs.h>
 #include <test_fs.h>
 #include <timer.h>
 #include <mailbox.h>
+#include <smp.h>
+#include <signal.h>
+#include <workqueue.h>
+#include <vdso.h>
+#include <printk.h>
+#include <mmu.h>
 
-extern Thread *run_thread_head;
 
 int main(unsigned long dtb_base){
 
+    /* the caches and the Normal memory for the ldaxr/stxr of the spinlocks */
+    mmu_init();
+    smp_init_boot_cpu();
+    printk_init();
+    irq_init();
+    timers_init();
+    vdso_init();
     uart_init();
     enable_el0_get_timer();
     // uart_getc();
@@ -26,10 +38,16 @@ int main(unsigned long dtb_base){
     framebuffer_init();
     all_allocator_init();    
     init_cpio_file_info();
-    rootfs_init("rootfs");
+    signal_init();
     init_thread_pool_and_head();
-    init_task_head();
+    rootfs_init("rootfs");
+    idle_thread_init();
+    softirq_init();
+    smp_boot_secondaries();
+    workqueue_init();
 
+    /* the scheduler tick of core 0 */
+    sched_timeout(NULL);
     enable_timer_irq();
     enable_irq(); // DAIF set to 0b0000
 
@@ -42,6 +60,7 @@ int main(unsigned long dtb_base){
     // fs_test5();
     // fs_test6();
     // fs_test7();
+    // fs_test8();
     // user_basic1();
     // user_advance1();
 
@@ -2,10 +2,13 @@
 #include <string.h>
 #include <allocator.h>
 #include <malloc.h>
+#include <spinlock.h>
 
 extern Frame *frames;
 extern Buddy *buddy_list;
 FreeChunkList *freechunk_list;
+/* protect freechunk_list, the chunk allocator is shared by all cpus */
+Spinlock chunk_lock;
 
 /* define 11 level common chunk size */
 unsigned int chunk_size[] = {0x10, 0x20, 0x30, 0x40, 0x60, 0x80, 
@@ -19,6 +22,7 @@ unsigned int find_level(unsigned int size){
     return i;
 }
 void freechunk_list_init(){
+    spin_lock_init(&chunk_lock, "chunk_lock");
     for(int i = 0; i < MAX_CHUNK_SIZE; i++){
         INIT_LIST_HEAD(&freechunk_list[i].list);
     }
@@ -27,8 +31,11 @@ void freechunk_list_init(){
 void *kmalloc(unsigned int size){
     void *addr;
 
-    if(size <= FRAME_SIZE / 2) 
+    if(size <= FRAME_SIZE / 2){
+        unsigned long flags = spin_lock_irqsave(&chunk_lock);
         addr = chunk_alloc(size);
+        spin_unlock_irqrestore(&chunk_lock, flags);
+    }
     else 
         addr = buddy_alloc(size);
 
@@ -43,8 +50,11 @@ void kfree(void *addr){
         return;
     }
     Frame *target_frame = &frames[idx];
-    if(target_frame->chunk_level >= 0)
+    if(target_frame->chunk_level >= 0){
+        unsigned long flags = spin_lock_irqsave(&chunk_lock);
         chunk_free(addr);
+        spin_unlock_irqrestore(&chunk_lock, flags);
+    }
     else
         buddy_free(addr);
 }
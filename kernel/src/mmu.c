@@ -0,0 +1,45 @@
+#include <mmu.h>
+
+extern char _start[];
+extern char _etext[];
+
+unsigned long pg_dir[PTRS_PER_TABLE] __attribute__((aligned(4096)));
+static unsigned long pmd[PTRS_PER_TABLE] __attribute__((aligned(4096))); // 0 - 1GB
+static unsigned long pte[PTRS_PER_TABLE] __attribute__((aligned(4096))); // 0 - 2MB
+
+#define NORMAL_RW   (PD_ATTR(MT_NORMAL) | PD_EL0_RW | PD_INNER_SHARE | PD_AF | PD_PXN)
+#define DEVICE_RW   (PD_ATTR(MT_DEVICE_nGnRnE) | PD_EL0_RW | PD_AF | PD_PXN | PD_UXN)
+
+/*
+ * Build the identity map and turn on the MMU of the boot core, before the first spinlock.
+ * The tables are written with the MMU off, so they are in the ram when the other cores walk them.
+ */
+void mmu_init(){
+    unsigned long text_start = (unsigned long)_start;
+    unsigned long text_end = (unsigned long)_etext;
+
+    for(unsigned long i = 0; i < PTRS_PER_TABLE; i++){
+        unsigned long addr = i << PAGE_SHIFT;
+        if(addr >= text_start && addr < text_end)
+            pte[i] = addr | PD_ATTR(MT_NORMAL) | PD_RO | PD_INNER_SHARE | PD_AF | PD_PAGE;
+        else
+            pte[i] = addr | NORMAL_RW | PD_PAGE;
+    }
+
+    pmd[0] = (unsigned long)pte | PD_TABLE;
+    for(unsigned long i = 1; i < PTRS_PER_TABLE; i++){
+        unsigned long addr = i << PMD_SHIFT;
+        if(addr < PERIPHERAL_BASE)
+            pmd[i] = addr | NORMAL_RW | PD_BLOCK;
+        else
+            pmd[i] = addr | DEVICE_RW | PD_BLOCK;
+    }
+
+    for(unsigned long i = 0; i < PTRS_PER_TABLE; i++)
+        pg_dir[i] = 0;
+    pg_dir[0] = (unsigned long)pmd | PD_TABLE;
+    pg_dir[LOCAL_PERIPHERAL_BASE >> PGD_SHIFT] =
+        LOCAL_PERIPHERAL_BASE | PD_ATTR(MT_DEVICE_nGnRnE) | PD_AF | PD_PXN | PD_UXN | PD_BLOCK;
+
+    enable_mmu();
+}
@@ -0,0 +1,122 @@
+#include <pl011.h>
+#include <uart.h>
+#include <gpio.h>
+#include <irq.h>
+#include <mailbox.h>
+
+static unsigned int __attribute__((aligned(16))) pl011_mbox[36];
+
+/*
+ * The fifo levels are not readable, FR only has the empty/full flags.
+ * An empty tx fifo takes PL011_FIFO_SIZE bytes, otherwise write one by one while not full.
+ */
+static unsigned int pl011_rx_level(){
+  unsigned int fr = *UART0_FR;
+  if(fr & FR_RXFF) return PL011_FIFO_SIZE;
+  return (fr & FR_RXFE) ? 0 : 1;
+}
+
+static unsigned int pl011_tx_room(){
+  unsigned int fr = *UART0_FR;
+  if(fr & FR_TXFE) return PL011_FIFO_SIZE;
+  return (fr & FR_TXFF) ? 0 : 1;
+}
+
+/* DR[11:8] are the error flags of the byte, the overrun is counted by the irq */
+static char pl011_read(){
+  return (char)(*UART0_DR & 0xff);
+}
+
+static void pl011_write(unsigned int c){
+  *UART0_DR = c;
+}
+
+/* the rx timeout interrupt takes the bytes below the rx level */
+static void pl011_rx_irq(int on){
+  if(on) *UART0_IMSC |= INT_RX | INT_RT;
+  else *UART0_IMSC &= ~(INT_RX | INT_RT);
+}
+
+/*
+ * The tx interrupt comes when the fifo drains through the tx level, not while it is below it,
+ * uart_start_tx fills an empty fifo itself.
+ */
+static void pl011_tx_irq(int on){
+  if(on) *UART0_IMSC |= INT_TX;
+  else *UART0_IMSC &= ~INT_TX;
+}
+
+const UartOps pl011_ops = {
+  .name = "pl011",
+  .fifo_size = PL011_FIFO_SIZE,
+  .rx_level = pl011_rx_level,
+  .tx_room = pl011_tx_room,
+  .read = pl011_read,
+  .write = pl011_write,
+  .rx_irq = pl011_rx_irq,
+  .tx_irq = pl011_tx_irq,
+};
+
+/*
+ * baud = PL011_CLOCK / (16 * (IBRD + FBRD / 64)), the divisor in 1/64 is PL011_CLOCK * 4 / baud.
+ * Called with the uart disabled, the divisors take effect on the next LCRH write.
+ */
+int pl011_set_baud(unsigned int baud){
+  if(baud == 0 || baud > PL011_CLOCK / 16) return -1;
+  unsigned int div = (unsigned int)(((unsigned long long)PL011_CLOCK * 4 + baud / 2) / baud);
+  *UART0_IBRD = div >> 6;
+  *UART0_FBRD = div & 0x3f;
+  return 0;
+}
+
+void pl011_init(unsigned int baud){
+  *UART0_CR = 0;                  // Disable the uart during configuration.
+  while(*UART0_FR & FR_BUSY) {asm volatile("nop");}
+  *UART0_LCRH = 0;                // Flush the fifos.
+
+  /* the firmware default of the uart clock is not fixed, set it for the divisors */
+  set_clock_rate(pl011_mbox, CLOCK_ID_UART, PL011_CLOCK);
+
+  /* map UART0 to GPIO pins, gpio 14/15 is TXD0/RXD0 (ALT0), gpio 16/17 is CTS0/RTS0 (ALT3) */
+  register unsigned int reg;
+  reg = *GPFSEL1;
+  reg &= ~((7<<12) | (7<<15));
+  reg |= ((4<<12) | (4<<15));
+#if PL011_FLOW_CTRL
+  reg &= ~((7<<18) | (7<<21));
+  reg |= ((7<<18) | (7<<21));
+#endif
+  *GPFSEL1 = reg;
+  /* disable the pull-up/down of the pins */
+  *GPPUD = 0;
+  for(reg = 150; reg > 0; reg--) {asm volatile("nop");}
+  *GPPUDCLK0 = (1<<14) | (1<<15) | (PL011_FLOW_CTRL ? (1<<16) | (1<<17) : 0);
+  for(reg = 150; reg > 0; reg--) {asm volatile("nop");}
+  *GPPUDCLK0 = 0;
+
+  *UART0_ICR = INT_ALL;           // Clear the pending interrupts.
+  if(pl011_set_baud(baud) < 0) pl011_set_baud(115200);
+  *UART0_LCRH = LCRH_WLEN_8 | LCRH_FEN; // 8N1, enable the 16-byte fifos
+  /* refill with 12 bytes when 4 are left, take the rx fifo at half */
+  *UART0_IFLS = IFLS_TX(IFLS_1_4) | IFLS_RX(IFLS_1_2);
+  *UART0_IMSC = INT_RX | INT_RT | INT_OE;
+  *UART0_CR = CR_UARTEN | CR_TXE | CR_RXE | (PL011_FLOW_CTRL ? CR_RTSEN | CR_CTSEN : 0);
+
+  request_irq(IRQ_UART0, pl011_irq_handler, "uart0", NULL);
+}
+
+/* IRQ_UART0 */
+void pl011_irq_handler(unsigned int irq, void *dev_id){
+  unsigned int mis = *UART0_MIS;
+  if(mis & INT_OE){
+    *UART0_ICR = INT_OE;
+    uart_rx_overrun();
+  }
+  /* the bytes after the clear raise it again, the softirq drains the ones before */
+  if(mis & (INT_RX | INT_RT)){
+    *UART0_ICR = INT_RX | INT_RT;
+    recv_interrupt_handler();
+  }
+  if(mis & INT_TX)
+    tran_interrupt_handler();
+}
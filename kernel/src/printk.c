@@ -0,0 +1,154 @@
+#include <printk.h>
+#include <spinlock.h>
+#include <workqueue.h>
+#include <uart.h>
+#include <string.h>
+
+static char log_buf[LOG_BUF_SIZE];
+/* the positions since boot, the byte of pos is log_buf[pos % LOG_BUF_SIZE] */
+static unsigned long long log_next; // the next byte to store
+static unsigned long long con_next; // the next byte for the console
+static int log_line_start = 1; // the next byte starts a line, store its "<level>"
+static unsigned long long con_dropped; // the bytes overwritten before the console got them
+/* protect the ring and the console state, printk is called in the irq handler too */
+static Spinlock logbuf_lock;
+
+/* the console parses "<level>" at every line start and skips the lines above console_loglevel */
+enum console_state{
+    CON_LINE_START,
+    CON_LEVEL,
+    CON_LEVEL_END,
+    CON_PRINT,
+    CON_SKIP,
+};
+static enum console_state con_state = CON_LINE_START;
+static int con_flushing; // one console_flush moves the bytes at a time, keep the order
+static Work console_work;
+
+int console_loglevel = CONSOLE_LOGLEVEL;
+
+static void console_flush(void *);
+
+void printk_init(){
+    spin_lock_init(&logbuf_lock, "logbuf_lock");
+    init_work(&console_work, console_flush, NULL);
+}
+
+static inline void log_putc(char c){
+    log_buf[log_next % LOG_BUF_SIZE] = c;
+    log_next++;
+}
+
+void log_write(int level, const char *s){
+    unsigned long flags = spin_lock_irqsave(&logbuf_lock);
+    for(; *s; s++){
+        if(log_line_start){
+            log_putc('<');
+            log_putc('0' + level);
+            log_putc('>');
+            log_line_start = 0;
+        }
+        log_putc(*s);
+        if(*s == '\n') log_line_start = 1;
+    }
+    spin_unlock_irqrestore(&logbuf_lock, flags);
+    /* the workqueue takes it once the kworker of this cpu runs, also before workqueue_init */
+    queue_work(&console_work);
+}
+
+/* the line longer than MAX_SIZE is cut */
+void log_printf(int level, const char *fmt, ...){
+    char buf[MAX_SIZE];
+    va_list args;
+    va_start(args, fmt);
+    kvsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    log_write(level, buf);
+}
+
+/*
+ * The work of the console: move the new lines at or below console_loglevel to the uart tx ring.
+ * async_uart_write may sleep when the ring is full, so it runs on the kworker, not in printk.
+ */
+static void console_flush(void *args){
+    char buf[CONSOLE_CHUNK];
+    unsigned long flags = spin_lock_irqsave(&logbuf_lock);
+    if(con_flushing){
+        spin_unlock_irqrestore(&logbuf_lock, flags);
+        return;
+    }
+    con_flushing = 1;
+    while(1){
+        /* overwritten, restart from the next whole line */
+        if(log_next - con_next > LOG_BUF_SIZE){
+            con_dropped += log_next - LOG_BUF_SIZE - con_next;
+            con_next = log_next - LOG_BUF_SIZE;
+            con_state = CON_SKIP;
+        }
+        unsigned int n = 0;
+        while(con_next < log_next && n < CONSOLE_CHUNK){
+            char c = log_buf[con_next % LOG_BUF_SIZE];
+            con_next++;
+            switch(con_state){
+                case CON_LINE_START:
+                    con_state = CON_LEVEL;
+                    break;
+                case CON_LEVEL:
+                    con_state = (c - '0') <= console_loglevel ? CON_LEVEL_END : CON_SKIP;
+                    break;
+                case CON_LEVEL_END:
+                    con_state = CON_PRINT;
+                    break;
+                case CON_PRINT:
+                    buf[n++] = c;
+                    if(c == '\n') con_state = CON_LINE_START;
+                    break;
+                case CON_SKIP:
+                    if(c == '\n') con_state = CON_LINE_START;
+                    break;
+            }
+        }
+        if(n == 0 && con_next == log_next){
+            con_flushing = 0;
+            break;
+        }
+        spin_unlock_irqrestore(&logbuf_lock, flags);
+        if(n) async_uart_write(buf, n, 1);
+        flags = spin_lock_irqsave(&logbuf_lock);
+    }
+    spin_unlock_irqrestore(&logbuf_lock, flags);
+}
+
+/* dmesg: the whole ring with the levels, the oldest line may be cut */
+void print_dmesg(){
+    char buf[CONSOLE_CHUNK + 1];
+    unsigned long flags = spin_lock_irqsave(&logbuf_lock);
+    unsigned long long pos = log_next > LOG_BUF_SIZE ? log_next - LOG_BUF_SIZE : 0;
+    unsigned long long end = log_next;
+    unsigned long long dropped = con_dropped;
+    spin_unlock_irqrestore(&logbuf_lock, flags);
+
+    /* skip the bytes overwritten while printing */
+    while(pos < end){
+        unsigned int n = 0;
+        flags = spin_lock_irqsave(&logbuf_lock);
+        if(log_next - pos > LOG_BUF_SIZE) pos = log_next - LOG_BUF_SIZE;
+        while(pos < end && n < CONSOLE_CHUNK){
+            buf[n++] = log_buf[pos % LOG_BUF_SIZE];
+            pos++;
+        }
+        spin_unlock_irqrestore(&logbuf_lock, flags);
+        buf[n] = '\0';
+        uart_nbyte(buf, n);
+    }
+    print_string(UITOA, "[*] dmesg: ", log_next, 0);
+    print_string(UITOA, " bytes logged | console dropped: ", dropped, 1);
+}
+
+/* loglevel [level], the lines above it are only kept in dmesg */
+void loglevel_arg(char *buf){
+    char *arg = strchr(buf, ' ');
+    if(arg != NULL && *(arg + 1) != '\0')
+        console_loglevel = atoi(arg + 1);
+    print_string(ITOA, "[*] console loglevel: ", console_loglevel, 1);
+}
@@ -9,14 +9,34 @@
 #include <syscall.h>
 #include <signal.h>
 #include <vfs.h>
+#include <smp.h>
+#include <timer.h>
+#include <softirq.h>
+#include <printk.h>
+#include <offsets.h>
+#include <io_ring.h>
+
+/* the getpid fast path in start.S reads it */
+_Static_assert(__builtin_offsetof(Thread, id) == THREAD_ID_OFFSET, "THREAD_ID_OFFSET");
 
 Thread *thread_pool;
-Thread *run_thread_head;
-extern char *global_dir;
-extern Dentry *global_dentry;
-extern File **global_fd_table;
+Thread *zombie_thread_head;
+Spinlock thread_pool_lock;
+Spinlock zombie_lock;
+extern Cpu cpus[NR_CPUS];
+extern Mount *rootfs;
+
+static inline unsigned long long read_cntpct(){
+    unsigned long long cnt;
+    asm volatile("mrs %0, cntpct_el0\n\t" :"=r"(cnt));
+    return cnt;
+}
+
+static void sleep_timeout(void *);
 
 void init_thread_pool_and_head(){
+    spin_lock_init(&thread_pool_lock, "thread_pool_lock");
+    spin_lock_init(&zombie_lock, "zombie_lock");
     thread_pool = (Thread*)kmalloc(sizeof(Thread) * MAX_THREAD);
     memset((char *)thread_pool, 0, sizeof(Thread) * MAX_THREAD);
     for(unsigned int i = 0; i < MAX_THREAD; i++){
@@ -27,6 +47,8 @@ void init_thread_pool_and_head(){
         thread_pool[i].kstack_addr = NULL;
         thread_pool[i].code_addr = NULL;
         thread_pool[i].code_size = 0;
+        hrtimer_init(&thread_pool[i].sleep_timer, sleep_timeout, &thread_pool[i]);
+        thread_pool[i].timer_slack_us = TIMER_SLACK_US;
         
         /* init signal */
         for(unsigned int j = 0; j < MAX_SIG_HANDLER; j++){
@@ -37,121 +59,755 @@ void init_thread_pool_and_head(){
         INIT_LIST_HEAD(&thread_pool[i].sig_queue_head.list);
         thread_pool[i].sig_stack_addr = NULL;
         thread_pool[i].old_tp = NULL;
+        thread_pool[i].io_ring = NULL;
+        thread_pool[i].parent = NULL;
+        INIT_LIST_HEAD(&thread_pool[i].children);
+        INIT_LIST_HEAD(&thread_pool[i].sibling);
+    }
 
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        INIT_LIST_HEAD(&cpus[i].rq);
+        spin_lock_init(&cpus[i].rq_lock, "rq_lock");
+        cpus[i].nr_running = 0;
     }
 
-    run_thread_head = (Thread *)kmalloc(sizeof(Thread));
-    memset((char *)run_thread_head, 0, sizeof(Thread));
-    INIT_LIST_HEAD(&run_thread_head->list);
-    run_thread_head->id = -1;
+    zombie_thread_head = (Thread *)kmalloc(sizeof(Thread));
+    memset((char *)zombie_thread_head, 0, sizeof(Thread));
+    INIT_LIST_HEAD(&zombie_thread_head->list);
+    zombie_thread_head->id = -1;
 
-    thread_create(idle_thread);
+    /* the boot context of core 0 (the shell) becomes a thread, then core 0 can schedule */
+    thread_init_current();
 }
 
-Thread *thread_create(void(*func)()){
+/* create the idle thread of this cpu, it inherits the working directory of the current thread */
+void idle_thread_init(){
+    get_cpu()->idle = thread_alloc(idle_thread);
+}
+
+static Thread *thread_pool_get(){
+    unsigned long flags = spin_lock_irqsave(&thread_pool_lock);
     unsigned int idx;
     for(idx = 0; idx < MAX_THREAD; idx++){
         if(thread_pool[idx].state == NOUSE)
             break;
     }
-    if(idx == MAX_THREAD) return NULL;
-
+    if(idx == MAX_THREAD){
+        spin_unlock_irqrestore(&thread_pool_lock, flags);
+        return NULL;
+    }
     Thread *new_thread = &thread_pool[idx];
     new_thread->state = RUNNING;
+    spin_unlock_irqrestore(&thread_pool_lock, flags);
+
+    INIT_LIST_HEAD(&new_thread->list);
+    new_thread->on_cpu = 0;
+    new_thread->cpu = smp_processor_id();
+    new_thread->cpus_allowed = CPU_MASK_ALL;
+    new_thread->preempt_count = 0;
+    new_thread->need_resched = 0;
+    new_thread->utime = 0;
+    new_thread->stime = 0;
+    new_thread->irqtime = 0;
+    new_thread->nvcsw = 0;
+    new_thread->nivcsw = 0;
+    /* the slot was detached from its parent and children before it was freed */
+    new_thread->parent = NULL;
+    INIT_LIST_HEAD(&new_thread->children);
+    INIT_LIST_HEAD(&new_thread->sibling);
+    new_thread->name[0] = '\0';
+    new_thread->exit_code = 0;
+    new_thread->used_fpsimd = 0;
+    new_thread->fpsimd_cpu = -1;
+    return new_thread;
+}
+
+/* allocate and init a thread, but don't add it in any runqueue */
+Thread *thread_alloc(void(*func)()){
+    Thread *new_thread = thread_pool_get();
+    if(new_thread == NULL) return NULL;
+
     new_thread->ustack_addr = kmalloc(STACK_SIZE);
     new_thread->kstack_addr = kmalloc(STACK_SIZE);
     new_thread->ctx.fp = (unsigned long)new_thread->kstack_addr + STACK_SIZE;
     new_thread->ctx.sp = (unsigned long)new_thread->kstack_addr + STACK_SIZE;
-    new_thread->ctx.lr = (unsigned long)func;
+    /* ret_from_kthread finishes the context switch, then calls func(x19) */
+    new_thread->ctx.lr = (unsigned long)ret_from_kthread;
+    new_thread->ctx.x19 = (unsigned long)func;
     
     for(unsigned int i = 0; i < MAX_SIG_HANDLER; i++){
         new_thread->sig_info_pool[i].handler = sig_default_handler;
         INIT_LIST_HEAD(&new_thread->sig_info_pool[i].list);
     }
 
+    /* inherit the working directory of the creator */
+    strcpy(new_thread->dir, global_dir);
+    new_thread->dentry = global_dentry;
 
-    print_string(UITOHEX, "[*] new_thread->ustack: ", (unsigned long long )new_thread->ustack_addr, 0);
-    uart_puts(" | ");
-    print_string(UITOHEX, "[*] new_thread->kstack: ", (unsigned long long )new_thread->kstack_addr, 1);
+    printk(LOGLEVEL_DEBUG, "[*] new_thread->ustack: %p | [*] new_thread->kstack: %p\n",
+            new_thread->ustack_addr, new_thread->kstack_addr);
 
+    return new_thread;
+}
 
-    list_add_tail(&new_thread->list, &run_thread_head->list);
+Thread *thread_create(void(*func)()){
+    Thread *new_thread = thread_alloc(func);
+    if(new_thread == NULL) return NULL;
+    wake_up_new_thread(new_thread);
+    return new_thread;
+}
 
+/* a named kernel thread, bound to the cpu if cpu >= 0 */
+Thread *kthread_create(void(*func)(), const char *name, int cpu){
+    Thread *new_thread = thread_alloc(func);
+    if(new_thread == NULL) return NULL;
+    unsigned int i;
+    for(i = 0; i < THREAD_NAME_LEN - 1 && name[i] != '\0'; i++)
+        new_thread->name[i] = name[i];
+    new_thread->name[i] = '\0';
+    if(cpu >= 0){
+        new_thread->cpus_allowed = 1 << cpu;
+        enqueue_thread(new_thread, cpu);
+    }
+    else
+        wake_up_new_thread(new_thread);
     return new_thread;
 }
 
+/* 
+ * Turn the running boot context into a thread without stacks,
+ * it keeps running on the boot stack.
+ */
+Thread *thread_init_current(){
+    Thread *thread = thread_pool_get();
+    Cpu *cpu = get_cpu();
+    thread->on_cpu = 1;
+    thread->cpu = cpu->id;
+    for(unsigned int i = 0; i < MAX_SIG_HANDLER; i++){
+        thread->sig_info_pool[i].handler = sig_default_handler;
+        INIT_LIST_HEAD(&thread->sig_info_pool[i].list);
+    }
+    /* the shell is created before rootfs_init, rootfs_init sets its dir and fd table */
+    strcpy(thread->dir, "/");
+    thread->dentry = (rootfs != NULL) ? rootfs->root_dentry : NULL;
+    asm volatile("mrs %0, cntpct_el0\n\t" :"=r"(cpu->acct_stamp));
+    cpu->current = thread;
+    return thread;
+}
+
+/* 
+ * Every cpu has an idle thread, it is not in the runqueue.
+ * It reaps the zombies and steals the threads from the busiest cpu.
+ */
 void idle_thread(){
+    Cpu *cpu = get_cpu();
     while(1){
         // kill zombie
         kill_zombie();
+        if(list_empty(&cpu->rq))
+            steal_thread(cpu);
         // call schedule
-        schedule();
+        if(!list_empty(&cpu->rq))
+            schedule();
+        else
+            asm volatile("wfe\n\t");
     }
 }
 
-void kill_zombie(){
-    disable_irq();
+/* pick the least loaded online cpu in the affinity mask */
+unsigned int select_cpu(Thread *thread){
+    unsigned int this_cpu = smp_processor_id();
+    unsigned int best = this_cpu;
+    unsigned int best_load = (unsigned int)-1;
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        if(!cpus[i].online || !(thread->cpus_allowed & (1 << i)))
+            continue;
+        unsigned int load = cpus[i].nr_running;
+        if(cpus[i].current != cpus[i].idle) load++;
+        /* prefer the current cpu if the load is the same */
+        if(load < best_load || (load == best_load && i == this_cpu)){
+            best = i;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+void enqueue_thread(Thread *thread, unsigned int cpu_id){
+    Cpu *cpu = &cpus[cpu_id];
+    unsigned long flags = spin_lock_irqsave(&cpu->rq_lock);
+    /* killed while it is moving between the cpus, or queued by schedule() before its waker */
+    if(thread->state != RUNNING || !list_empty(&thread->list)){
+        spin_unlock_irqrestore(&cpu->rq_lock, flags);
+        return;
+    }
+    thread->cpu = cpu_id;
+    list_add_tail(&thread->list, &cpu->rq);
+    cpu->nr_running++;
+    /* this cpu is idle, switch to the thread on unlock */
+    if(cpu_id == smp_processor_id() && cpu->current == cpu->idle)
+        set_need_resched();
+    spin_unlock_irqrestore(&cpu->rq_lock, flags);
+    /* wake up the idle cpu waiting in wfe */
+    if(cpu_id != smp_processor_id())
+        asm volatile("dsb sy\n\tsev\n\t");
+}
+
+/* remove the thread from its runqueue if it is queued */
+void dequeue_thread(Thread *thread){
+    Cpu *cpu;
+    unsigned long flags;
+    /* the thread may be stolen by another cpu before we get the lock */
+    while(1){
+        cpu = &cpus[thread->cpu];
+        flags = spin_lock_irqsave(&cpu->rq_lock);
+        if(thread->cpu == cpu->id) break;
+        spin_unlock_irqrestore(&cpu->rq_lock, flags);
+    }
+    if(!list_empty(&thread->list)){
+        list_del(&thread->list);
+        cpu->nr_running--;
+    }
+    spin_unlock_irqrestore(&cpu->rq_lock, flags);
+}
+
+void wake_up_new_thread(Thread *thread){
+    enqueue_thread(thread, select_cpu(thread));
+}
+
+/* 
+ * The first runnable thread which isn't running on another cpu.
+ * (a thread is still running on the old cpu until its context is saved)
+ * The caller should hold the rq_lock.
+ */
+static Thread *pick_next_thread(Cpu *cpu){
     struct list_head *pos;
-    list_for_each(pos, &run_thread_head->list){
+    list_for_each(pos, &cpu->rq){
         Thread *tmp = (Thread *)pos;
-        if(tmp->state == EXIT){
-            kfree(tmp->ustack_addr);
-            kfree(tmp->kstack_addr);
-            tmp->ustack_addr = NULL;
-            tmp->kstack_addr = NULL;
-            tmp->code_addr = NULL;
-            tmp->code_size = 0;
-            tmp->state = NOUSE;
-            /* cannot remove code_addr beacuse fork process share the code?? */
-            // if(tmp->code_addr != NULL){
-            //     kfree(tmp->code_addr);
-            // }
-           
-            /* init signal */
-            for(unsigned int i = 0; i < MAX_SIG_HANDLER; i++){
-                tmp->sig_info_pool[i].ready = 0;
-                tmp->sig_info_pool[i].handler = sig_default_handler;
-                INIT_LIST_HEAD(&tmp->sig_info_pool[i].list);
+        if(!tmp->on_cpu){
+            list_del(&tmp->list);
+            cpu->nr_running--;
+            return tmp;
+        }
+    }
+    return NULL;
+}
+
+/* 
+ * Pull one thread from the cpu which has the most queued threads,
+ * called by the idle thread when its runqueue is empty.
+ */
+int steal_thread(Cpu *this_cpu){
+    Cpu *busiest = NULL;
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        if(i == this_cpu->id || !cpus[i].online) continue;
+        if(cpus[i].nr_running == 0) continue;
+        if(busiest == NULL || cpus[i].nr_running > busiest->nr_running)
+            busiest = &cpus[i];
+    }
+    if(busiest == NULL) return 0;
+
+    Thread *target = NULL;
+    unsigned long flags = spin_lock_irqsave(&busiest->rq_lock);
+    struct list_head *pos;
+    /* the tail of the runqueue waits the longest time to run on the busiest cpu */
+    for(pos = busiest->rq.prev; !list_is_head(pos, &busiest->rq); pos = pos->prev){
+        Thread *tmp = (Thread *)pos;
+        if(!tmp->on_cpu && (tmp->cpus_allowed & (1 << this_cpu->id))){
+            list_del(&tmp->list);
+            busiest->nr_running--;
+            target = tmp;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&busiest->rq_lock, flags);
+
+    if(target == NULL) return 0;
+    this_cpu->nr_steal++;
+    enqueue_thread(target, this_cpu->id);
+    return 1;
+}
+
+int do_sched_setaffinity(int pid, unsigned int mask){
+    if(!(pid >= 0 && pid < MAX_THREAD))
+        return -1;
+    unsigned int online_mask = 0;
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        if(cpus[i].online) online_mask |= 1 << i;
+    }
+    if((mask & online_mask) == 0)
+        return -1;
+
+    Thread *thread = &thread_pool[pid];
+    if(!thread_is_alive(thread))
+        return -1;
+    thread->cpus_allowed = mask;
+
+    /* the thread is running, it moves to the allowed cpu in the next schedule */
+    if(thread->on_cpu){
+        if(thread == get_current() && !(mask & (1 << thread->cpu)))
+            schedule();
+        return 0;
+    }
+
+    /* the thread is queued in a disallowed cpu, move it now */
+    if(!(mask & (1 << thread->cpu))){
+        dequeue_thread(thread);
+        enqueue_thread(thread, select_cpu(thread));
+    }
+    return 0;
+}
+
+int do_sched_getaffinity(int pid){
+    if(!(pid >= 0 && pid < MAX_THREAD))
+        return -1;
+    if(!thread_is_alive(&thread_pool[pid]))
+        return -1;
+    return thread_pool[pid].cpus_allowed;
+}
+
+static void zombie_add(Thread *thread){
+    spin_lock(&zombie_lock);
+    list_add_tail(&thread->list, &zombie_thread_head->list);
+    spin_unlock(&zombie_lock);
+}
+
+/* 
+ * The caller holds thread_pool_lock.
+ * The sleeper may not be switched out yet, then queue it on its own cpu,
+ * the rq_lock orders it with the requeue in schedule(), only one of them queues it.
+ */
+static void __wake_up_thread(Thread *thread){
+    thread->state = RUNNING;
+    if(thread->on_cpu){
+        enqueue_thread(thread, thread->cpu);
+        return;
+    }
+    /* see the list written by schedule() before on_cpu is cleared */
+    asm volatile("dmb ish\n\t" ::: "memory");
+    enqueue_thread(thread, select_cpu(thread));
+}
+
+/* return 1 if the thread was sleeping */
+int wake_up_thread(Thread *thread){
+    unsigned long flags = spin_lock_irqsave(&thread_pool_lock);
+    if(thread->state != SLEEPING){
+        spin_unlock_irqrestore(&thread_pool_lock, flags);
+        return 0;
+    }
+    __wake_up_thread(thread);
+    spin_unlock_irqrestore(&thread_pool_lock, flags);
+    return 1;
+}
+
+/* 
+ * Make the thread a zombie with the exit code.
+ * The orphan zombies go to zombie_thread_head for the idle thread,
+ * a child waits for its parent in wait_child, and the parent gets SIGCHLD.
+ * The caller should disable the irq.
+ * Return -1 if the thread is not alive (killed by others).
+ */
+int thread_to_zombie(Thread *thread, int exit_code){
+    spin_lock(&thread_pool_lock);
+    if(!thread_is_alive(thread)){
+        spin_unlock(&thread_pool_lock);
+        return -1;
+    }
+    thread->state = EXIT;
+    thread->exit_code = exit_code;
+    dequeue_thread(thread);
+    hrtimer_cancel(&thread->sleep_timer);
+
+    /* the children have no one to wait for them now, only its own children are walked */
+    while(!list_empty(&thread->children)){
+        Thread *child = list_first_entry(&thread->children, Thread, sibling);
+        list_del(&child->sibling);
+        child->parent = NULL;
+        if(child->state == EXIT) zombie_add(child);
+    }
+
+    Thread *parent = thread->parent;
+    if(parent == NULL)
+        zombie_add(thread);
+    else{
+        do_signal_kill(parent->id, SIGCHLD);
+        if(parent->state == SLEEPING)
+            __wake_up_thread(parent);
+    }
+    spin_unlock(&thread_pool_lock);
+    return 0;
+}
+
+/* 
+ * Sleep until wake_up_thread, for the caller waiting for a condition:
+ * prepare_to_sleep, check the condition, then schedule() to sleep or sleep_cancel().
+ * The irq is masked in between, so the thread isn't preempted while it is SLEEPING.
+ * Return -1 if the thread is killed.
+ */
+int prepare_to_sleep(){
+    Thread *curr_thread = get_current();
+    disable_irq();
+    spin_lock(&thread_pool_lock);
+    if(!thread_is_alive(curr_thread)){
+        spin_unlock(&thread_pool_lock);
+        enable_irq();
+        return -1;
+    }
+    curr_thread->wakeup_time = (unsigned long long)-1;
+    curr_thread->state = SLEEPING;
+    spin_unlock(&thread_pool_lock);
+    return 0;
+}
+
+/* the condition is true already, keep running */
+void sleep_cancel(){
+    Thread *curr_thread = get_current();
+    spin_lock(&thread_pool_lock);
+    if(curr_thread->state == SLEEPING)
+        curr_thread->state = RUNNING;
+    spin_unlock(&thread_pool_lock);
+    enable_irq();
+}
+
+/* fork and spawn, the child of a dying parent is an orphan */
+void thread_set_parent(Thread *child, Thread *parent){
+    unsigned long flags = spin_lock_irqsave(&thread_pool_lock);
+    if(thread_is_alive(parent)){
+        child->parent = parent;
+        list_add_tail(&child->sibling, &parent->children);
+    }
+    else
+        child->parent = NULL;
+    spin_unlock_irqrestore(&thread_pool_lock, flags);
+}
+
+/* 
+ * Wait for the child pid (-1: any child) to exit and reap it.
+ * Return the pid of the reaped child, 0 if nohang and no child has exited,
+ * -1 if there is no such child.
+ */
+int wait_child(int pid, int *status, int nohang){
+    Thread *curr_thread = get_current();
+    Thread *zombie;
+    while(1){
+        unsigned long flags = spin_lock_irqsave(&thread_pool_lock);
+        int found = 0;
+        zombie = NULL;
+        Thread *child;
+        list_for_each_entry(child, &curr_thread->children, sibling){
+            if(pid != -1 && child->id != pid) continue;
+            found = 1;
+            if(child->state == EXIT){
+                zombie = child;
+                break;
             }
-            INIT_LIST_HEAD(&tmp->sig_queue_head.list);
-            if(tmp->sig_stack_addr != NULL)
-                kfree(tmp->sig_stack_addr);
-            if(tmp->old_tp != NULL)
-                kfree(tmp->old_tp);
-            tmp->sig_stack_addr = NULL;
-            tmp->old_tp = NULL;
-
-            /* init vfs */
-            tmp->dentry = NULL;
-            memset(tmp->dir, 0, MAX_PATHNAME_LEN * 16);
-            for(int i = 0; i < MAX_FD_NUM; i++){
-                if(tmp->fd_table[i] != NULL){
-                    vfs_close(tmp->fd_table[i]);
-                    tmp->fd_table[i] = NULL;
-                }
+        }
+        if(!found || (zombie == NULL && nohang)){
+            spin_unlock_irqrestore(&thread_pool_lock, flags);
+            return found ? 0 : -1;
+        }
+        if(zombie != NULL){
+            /* detach it, nobody else reaps it now */
+            list_del(&zombie->sibling);
+            zombie->parent = NULL;
+            spin_unlock_irqrestore(&thread_pool_lock, flags);
+            break;
+        }
+        /* thread_to_zombie of the child wakes it up, the irq stays masked until schedule() */
+        curr_thread->wakeup_time = (unsigned long long)-1;
+        curr_thread->state = SLEEPING;
+        spin_unlock(&thread_pool_lock);
+        schedule();
+    }
+
+    /* the zombie may still be switching out on another cpu */
+    while(zombie->on_cpu)
+        asm volatile("wfe\n\t");
+    int child_pid = zombie->id;
+    if(status != NULL) *status = zombie->exit_code;
+    reap_thread(zombie);
+    return child_pid;
+}
+
+/* 
+ * The timer callback of sleep_ticks, it runs on the cpu the thread slept on.
+ * del_timer doesn't wait for a running callback, the thread may be killed and its slot reused,
+ * so only wake it up if it is sleeping and its wakeup time has come.
+ */
+static void sleep_timeout(void *args){
+    Thread *thread = (Thread *)args;
+    unsigned long flags = spin_lock_irqsave(&thread_pool_lock);
+    if(thread->state == SLEEPING && thread->wakeup_time <= read_cntpct())
+        __wake_up_thread(thread);
+    spin_unlock_irqrestore(&thread_pool_lock, flags);
+}
+
+/* 
+ * Park the current thread for ticks of cntpct, it uses no cpu until the timer wakes it up.
+ * It may oversleep by its timer_slack_us, so the near wakeups are batched in one timer irq.
+ * The irq is masked from SLEEPING to the switch, the timer can't fire before it is switched out.
+ */
+void sleep_ticks(unsigned long long ticks){
+    Thread *curr_thread = get_current();
+    unsigned long long frq;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+    if(ticks == 0){
+        schedule();
+        return;
+    }
+
+    disable_irq();
+    spin_lock(&thread_pool_lock);
+    /* killed by others, schedule() doesn't come back */
+    int killed = !thread_is_alive(curr_thread);
+    if(!killed){
+        curr_thread->wakeup_time = read_cntpct() + ticks;
+        curr_thread->state = SLEEPING;
+    }
+    spin_unlock(&thread_pool_lock);
+    if(!killed)
+        hrtimer_start(&curr_thread->sleep_timer, curr_thread->wakeup_time,
+                    curr_thread->timer_slack_us * (frq / 1000000));
+    schedule();
+}
+
+/* 
+ * Reap at most ZOMBIE_REAP_BATCH threads from zombie_thread_head.
+ * Every resource is released under its own lock in a short section,
+ * so the lock hold time does not depend on the number of threads.
+ * The zombie still running on a cpu (killed by others) is reaped later.
+ */
+void kill_zombie(){
+    for(unsigned int reaped = 0; reaped < ZOMBIE_REAP_BATCH; reaped++){
+        Thread *tmp = NULL;
+        unsigned long flags = spin_lock_irqsave(&zombie_lock);
+        struct list_head *pos;
+        list_for_each(pos, &zombie_thread_head->list){
+            if(!((Thread *)pos)->on_cpu){
+                tmp = (Thread *)pos;
+                list_del(&tmp->list);
+                break;
             }
+        }
+        spin_unlock_irqrestore(&zombie_lock, flags);
+        if(tmp == NULL) return;
 
-            /* remove from run_thread_head */
-            list_del_entry(&tmp->list);
+        reap_thread(tmp);
+    }
+}
+
+void reap_thread(Thread *tmp){
+    /* armed by the thread itself after it is killed */
+    hrtimer_cancel(&tmp->sleep_timer);
+    tmp->timer_slack_us = TIMER_SLACK_US;
+    /* the thread from thread_init_current has no stacks */
+    if(tmp->ustack_addr != NULL)
+        kfree(tmp->ustack_addr);
+    if(tmp->kstack_addr != NULL)
+        kfree(tmp->kstack_addr);
+    tmp->ustack_addr = NULL;
+    tmp->kstack_addr = NULL;
+    tmp->code_addr = NULL;
+    tmp->code_size = 0;
+    io_ring_free(tmp);
+    /* cannot remove code_addr beacuse fork process share the code?? */
+    // if(tmp->code_addr != NULL){
+    //     kfree(tmp->code_addr);
+    // }
+
+    /* init signal */
+    unsigned long flags = spin_lock_irqsave(&signal_lock);
+    for(unsigned int i = 0; i < MAX_SIG_HANDLER; i++){
+        tmp->sig_info_pool[i].ready = 0;
+        tmp->sig_info_pool[i].handler = sig_default_handler;
+        INIT_LIST_HEAD(&tmp->sig_info_pool[i].list);
+    }
+    INIT_LIST_HEAD(&tmp->sig_queue_head.list);
+    if(tmp->sig_stack_addr != NULL)
+        kfree(tmp->sig_stack_addr);
+    if(tmp->old_tp != NULL)
+        kfree(tmp->old_tp);
+    tmp->sig_stack_addr = NULL;
+    tmp->old_tp = NULL;
+    spin_unlock_irqrestore(&signal_lock, flags);
+
+    /* init vfs */
+    tmp->dentry = NULL;
+    memset(tmp->dir, 0, MAX_PATHNAME_LEN * 16);
+
+    for(int i = 0; i < MAX_FD_NUM; i++){
+        spin_lock(&vfs_lock);
+        if(tmp->fd_table[i] != NULL){
+            vfs_close(tmp->fd_table[i]);
+            tmp->fd_table[i] = NULL;
         }
+        spin_unlock(&vfs_lock);
+    }
+
+    /* the slot can be used by thread_create now */
+    flags = spin_lock_irqsave(&thread_pool_lock);
+    tmp->state = NOUSE;
+    spin_unlock_irqrestore(&thread_pool_lock, flags);
+}
+
+/* the irq is disabled */
+static void sched_latency_update(Cpu *cpu){
+    if(cpu->resched_start == 0) return;
+    unsigned long long lat = read_cntpct() - cpu->resched_start;
+    cpu->resched_start = 0;
+    if(lat > cpu->sched_lat_max) cpu->sched_lat_max = lat;
+    cpu->sched_lat_total += lat;
+    cpu->nr_sched_lat++;
+}
+
+static void __schedule(int);
+
+/* 
+ * CPU time accounting
+ * The time between two charges goes to the current thread, it is charged
+ * on the exception entry (user or kernel time by spsr), on the exception exit (kernel),
+ * after the irq handler (irq) and before cpu_switch_to (kernel).
+ */
+void account_cpu_time(int type){
+    unsigned long flags = local_irq_save();
+    Cpu *cpu = get_cpu();
+    Thread *curr_thread = cpu->current;
+    unsigned long long now = read_cntpct();
+    if(curr_thread != NULL){
+        unsigned long long delta = now - cpu->acct_stamp;
+        if(type == ACCT_USER) curr_thread->utime += delta;
+        else if(type == ACCT_IRQ) curr_thread->irqtime += delta;
+        else curr_thread->stime += delta;
+    }
+    cpu->acct_stamp = now;
+    local_irq_restore(flags);
+}
+
+/* the exception is taken from EL0 if spsr.M is 0 */
+void account_exc_enter(unsigned long long spsr){
+    account_cpu_time((spsr & 0b1111) == 0 ? ACCT_USER : ACCT_SYS);
+}
+
+/* 
+ * Kernel preemption
+ * The timer irq sets need_resched of the current thread,
+ * it is scheduled out at the next preemption point:
+ * irq_exit or preempt_enable when the preempt_count drops to 0.
+ */
+void preempt_disable(){
+    Thread *curr_thread = get_current();
+    if(curr_thread != NULL) curr_thread->preempt_count++;
+    asm volatile("" ::: "memory");
+}
+
+void preempt_enable_no_resched(){
+    asm volatile("" ::: "memory");
+    Thread *curr_thread = get_current();
+    if(curr_thread != NULL) curr_thread->preempt_count--;
+}
+
+void preempt_enable(){
+    preempt_enable_no_resched();
+    Thread *curr_thread = get_current();
+    /* schedule only with the irq enabled, the caller masking the irq isn't ready for it */
+    if(curr_thread != NULL && curr_thread->preempt_count == 0 && curr_thread->need_resched && !irqs_disabled())
+        preempt_schedule();
+}
+
+void preempt_schedule(){
+    get_cpu()->nr_preempt++;
+    __schedule(1);
+}
+
+/* called with the irq disabled (timer irq, enqueue_thread) */
+void set_need_resched(){
+    Cpu *cpu = get_cpu();
+    if(cpu->current == NULL) return;
+    if(!cpu->current->need_resched && cpu->resched_start == 0)
+        cpu->resched_start = read_cntpct();
+    cpu->current->need_resched = 1;
+}
+
+void irq_enter(){
+    Thread *curr_thread = get_current();
+    get_cpu()->hardirq_start = read_cntpct();
+    if(curr_thread != NULL) curr_thread->preempt_count += HARDIRQ_OFFSET;
+}
+
+/* the irq has been masked since irq_enter */
+static void hardirq_time_update(Cpu *cpu){
+    unsigned long long time = read_cntpct() - cpu->hardirq_start;
+    if(time > cpu->hardirq_max) cpu->hardirq_max = time;
+    cpu->hardirq_total += time;
+    cpu->nr_hardirq++;
+}
+
+/* the bottom halves and the preemption point of the irq, the irq is masked on return */
+void irq_exit(){
+    Thread *curr_thread = get_current();
+    hardirq_time_update(get_cpu());
+    if(curr_thread == NULL) return;
+    curr_thread->preempt_count -= HARDIRQ_OFFSET;
+    /* not in the nested irq or the softirq it interrupted */
+    if(!(curr_thread->preempt_count & (HARDIRQ_MASK | SOFTIRQ_MASK)) && get_cpu()->softirq_pending)
+        do_softirq();
+    if(curr_thread->preempt_count == 0 && curr_thread->need_resched){
+        preempt_schedule();
+        disable_irq();
     }
-    enable_irq();
 }
 
 void schedule(){
+    __schedule(0);
+}
+
+/* preempt: the running thread is scheduled out by the preemption, not by itself */
+static void __schedule(int preempt){
     disable_irq();
-    Thread *curr_thread = get_current();
-    Thread *next_thread = curr_thread;
-    do{
-        next_thread = (Thread *)next_thread->list.next;
-    }while(list_is_head(&next_thread->list, &run_thread_head->list) || next_thread->state == EXIT);
+    Cpu *cpu = get_cpu();
+    Thread *curr_thread = cpu->current;
+    if(curr_thread == NULL){
+        enable_irq();
+        return;
+    }
+    int migrate = 0;
+
+    if(curr_thread->need_resched){
+        curr_thread->need_resched = 0;
+        sched_latency_update(cpu);
+    }
+
+    spin_lock(&cpu->rq_lock);
+    /* put the running thread back to the runqueue (the exited thread is in zombie_thread_head) */
+    /* a woken thread may be queued by wake_up_thread already */
+    if(curr_thread->state == RUNNING && curr_thread != cpu->idle && list_empty(&curr_thread->list)){
+        if(curr_thread->cpus_allowed & (1 << cpu->id)){
+            list_add_tail(&curr_thread->list, &cpu->rq);
+            cpu->nr_running++;
+        }
+        else
+            migrate = 1;
+    }
+    Thread *next_thread = pick_next_thread(cpu);
+    if(next_thread == NULL) next_thread = cpu->idle;
+    next_thread->on_cpu = 1;
+    next_thread->cpu = cpu->id;
+    spin_unlock(&cpu->rq_lock);
+
+    /* the affinity mask doesn't allow this cpu, on_cpu keeps others from running it before the switch */
+    if(migrate)
+        enqueue_thread(curr_thread, select_cpu(curr_thread));
+
+    if(next_thread == curr_thread){
+        enable_irq();
+        return;
+    }
 
-    strcpy(curr_thread->dir, global_dir);
-    curr_thread->dentry = global_dentry;
+    if(preempt && curr_thread->state == RUNNING) curr_thread->nivcsw++;
+    else curr_thread->nvcsw++;
+    account_cpu_time(ACCT_SYS);
 
-    strcpy(global_dir, next_thread->dir);
-    global_dentry = next_thread->dentry;
-    global_fd_table = next_thread->fd_table; 
+    fpsimd_thread_switch(curr_thread, next_thread);
     
     // print_string(UITOA, "[*] next_thread->id: ", next_thread->id, 0);
     // uart_puts(" | ");
@@ -165,28 +821,31 @@ void schedule(){
     // uart_puts(" | ");
     // print_string(UITOHEX, "next: ", next_thread->id, 1);
     // print_run_thread();
+    Thread *prev_thread = cpu_switch_to(curr_thread, next_thread);
+    schedule_tail(prev_thread);
     enable_irq();
-    cpu_switch_to(curr_thread, next_thread);
 }
 
-
+/* 
+ * Called by the next thread after cpu_switch_to,
+ * the context of prev thread is saved, other cpus can run it now.
+ */
+void schedule_tail(Thread *prev_thread){
+    asm volatile("dmb ish\n\t" ::: "memory");
+    prev_thread->on_cpu = 0;
+    /* the idle cpu may wait for this thread in wfe */
+    asm volatile("dsb ish\n\tsev\n\t");
+}
 
 void kernel_main() {
-    disable_irq();
-    /* the first thread that is fake thread */
-    Thread curr_thread;
-
-    thread_create(idle_thread);
-    /* create the idle thread first */
     for(int i = 0; i < 5; i++){
         thread_create(foo);
     }
 
-    Thread *next_thread = (Thread *)run_thread_head->list.next;
-
     print_run_thread();
-    enable_irq();
-    cpu_switch_to(&curr_thread, next_thread);
+    while(1){
+        schedule();
+    }
 }
 
 
@@ -220,14 +879,142 @@ void foo(){
 
 void print_run_thread(){
     struct list_head *pos;
-    unsigned int first = 1;
-    list_for_each(pos, &run_thread_head->list){
-        Thread *tmp = (Thread *)pos;
-        if(first){
-            print_string(UITOA, "run_thread: pid", tmp->id, 0);
-            first = 0;
-        } 
-        else print_string(UITOA, " -> pid", tmp->id, 0);
-    }
-    uart_puts("\n");
-}
\ No newline at end of file
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        if(!cpus[i].online) continue;
+        unsigned long flags = spin_lock_irqsave(&cpus[i].rq_lock);
+        print_string(UITOA, "cpu", i, 0);
+        if(cpus[i].current != NULL)
+            print_string(UITOA, " running: pid", cpus[i].current->id, 0);
+        print_string(UITOA, " | run_thread: ", cpus[i].nr_running, 0);
+        list_for_each(pos, &cpus[i].rq){
+            Thread *tmp = (Thread *)pos;
+            print_string(UITOA, " -> pid", tmp->id, 0);
+        }
+        spin_unlock_irqrestore(&cpus[i].rq_lock, flags);
+        print_string(UITOA, " | steal: ", cpus[i].nr_steal, 0);
+        print_string(UITOA, " | kick: ", cpus[i].nr_kick, 0);
+        print_string(UITOA, " | fpsimd load: ", cpus[i].nr_fpsimd_load, 0);
+        print_string(UITOA, " | fpsimd save: ", cpus[i].nr_fpsimd_save, 1);
+    }
+}
+
+int do_thread_stat(int pid, ThreadStat *stat){
+    if(pid < 0 || pid >= MAX_THREAD || stat == NULL) return -1;
+    Thread *thread = &thread_pool[pid];
+    if(thread->state == NOUSE) return -1;
+
+    unsigned long long frq;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+    stat->pid = thread->id;
+    stat->cpu = thread->cpu;
+    stat->state = thread->state;
+    stat->utime_us = thread->utime * 1000000 / frq;
+    stat->stime_us = thread->stime * 1000000 / frq;
+    stat->irqtime_us = thread->irqtime * 1000000 / frq;
+    stat->nvcsw = thread->nvcsw;
+    stat->nivcsw = thread->nivcsw;
+    return 0;
+}
+
+/* 
+ * SCHED_SOFTIRQ, raised by the tick.
+ * Threads are waiting on this cpu, wake up an idle cpu waiting in wfe to steal them.
+ */
+void sched_softirq(){
+    Cpu *cpu = get_cpu();
+    if(cpu->nr_running == 0) return;
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        if(i == cpu->id || !cpus[i].online) continue;
+        if(cpus[i].current == cpus[i].idle && cpus[i].nr_running == 0){
+            cpu->nr_kick++;
+            asm volatile("dsb sy\n\tsev\n\t");
+            return;
+        }
+    }
+}
+
+/* the cpu time of every thread from do_thread_stat, %cpu is the share of the uptime */
+void print_top(){
+    unsigned long long frq, now;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+    now = read_cntpct() * 1000000 / frq;
+    uart_puts("  pid | ppid | cpu | state | user(ms) | sys(ms) | irq(ms) | %cpu | vcsw | ivcsw\n");
+    for(unsigned int i = 0; i < MAX_THREAD; i++){
+        Thread *thread = &thread_pool[i];
+        ThreadStat stat;
+        if(do_thread_stat(i, &stat) < 0) continue;
+        unsigned long long total = stat.utime_us + stat.stime_us + stat.irqtime_us;
+        print_string(UITOA, "  ", stat.pid, 0);
+        if(thread->name[0] != '\0'){
+            uart_puts(" ");
+            uart_puts(thread->name);
+        }
+        if(thread->parent != NULL) print_string(UITOA, " | ", thread->parent->id, 0);
+        else uart_puts(" | -");
+        print_string(UITOA, " | ", stat.cpu, 0);
+        if(stat.state == RUNNING) uart_puts(" | run");
+        else if(stat.state == SLEEPING) uart_puts(" | sleep");
+        else uart_puts(" | exit");
+        print_string(UITOA, " | ", stat.utime_us / 1000, 0);
+        print_string(UITOA, " | ", stat.stime_us / 1000, 0);
+        print_string(UITOA, " | ", stat.irqtime_us / 1000, 0);
+        print_string(UITOA, " | ", now ? total * 100 / now : 0, 0);
+        print_string(UITOA, " | ", stat.nvcsw, 0);
+        print_string(UITOA, " | ", stat.nivcsw, 1);
+    }
+}
+
+void print_sched_latency(){
+    unsigned long long frq;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        if(!cpus[i].online) continue;
+        print_string(UITOA, "cpu", i, 0);
+        print_string(UITOA, " | preempt: ", cpus[i].nr_preempt, 0);
+        print_string(UITOA, " | resched: ", cpus[i].nr_sched_lat, 0);
+        print_string(UITOA, " | max latency(us): ", cpus[i].sched_lat_max * 1000000 / frq, 0);
+        print_string(UITOA, " | avg latency(ns): ",
+                    cpus[i].nr_sched_lat ? cpus[i].sched_lat_total / cpus[i].nr_sched_lat * 1000000000 / frq : 0, 1);
+    }
+}
+
+/* 
+ * Fork/exec benchmark: spawn BENCH_THREADS copies of the program with kernel_spawn
+ * (load, exec in a new thread, run to exit) and reap them with wait_child,
+ * with the affinity mask of 1, 2, 3, 4 cpus, and compare the time.
+ * The children inherit the mask of the caller, the caller gets its own mask back at the end.
+ */
+void sched_bench(char *path){
+    unsigned long long start, end, frq;
+    unsigned long long base = 0;
+    Thread *current = get_current();
+    unsigned int old_mask = current->cpus_allowed;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+
+    for(unsigned int ncpu = 1; ncpu <= NR_CPUS; ncpu++){
+        if(!cpus[ncpu - 1].online) break;
+        do_sched_setaffinity(current->id, (1 << ncpu) - 1);
+
+        unsigned int nr = 0;
+        asm volatile("mrs %0, cntpct_el0\n\t" :"=r"(start));
+        for(unsigned int i = 0; i < BENCH_THREADS; i++){
+            if(kernel_spawn(path) < 0) break;
+            nr++;
+        }
+        for(unsigned int i = 0; i < nr; i++)
+            wait_child(-1, NULL, 0);
+        asm volatile("mrs %0, cntpct_el0\n\t" :"=r"(end));
+
+        if(nr < BENCH_THREADS){
+            print_string(UITOA, "[x] sched_bench: spawned ", nr, 0);
+            print_string(UITOA, " of ", BENCH_THREADS, 1);
+            break;
+        }
+        unsigned long long us = (end - start) * 1000000 / frq;
+        if(base == 0) base = us;
+        print_string(UITOA, "[*] sched_bench: cpus = ", ncpu, 0);
+        print_string(UITOA, " | time(us) = ", us, 0);
+        print_string(UITOA, " | speedup(x100) = ", us ? base * 100 / us : 0, 1);
+    }
+    do_sched_setaffinity(current->id, old_mask);
+}
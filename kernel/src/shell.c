@@ -10,8 +10,11 @@
 #include <syscall.h>
 #include <irq.h>
 #include <vfs.h>
-
-extern char *global_dir;
+#include <sched.h>
+#include <workqueue.h>
+#include <vdso.h>
+#include <softirq.h>
+#include <printk.h>
 
 /* print welcome message*/
 void PrintWelcome(){
@@ -41,6 +44,22 @@ void PrintHelp(){
   uart_puts("mount        : mount a filesystem\n");
   uart_puts("umount       : umount a filesystem\n");
   uart_puts("exec         : exec a file in filesystem\n");
+  uart_puts("run          : run a file in filesystem and wait for it\n");
+  uart_puts("ps           : print the runqueue of every cpu\n");
+  uart_puts("sched_bench  : run 8 copies of a file on 1 to 4 cpus, 'sched_bench <file>'\n");
+  uart_puts("lockstat     : print the spinlock statistics\n");
+  uart_puts("schedlat     : print the preemption and scheduling latency\n");
+  uart_puts("top          : print the cpu time of every thread\n");
+  uart_puts("workqueue    : print the work done by every kworker\n");
+  uart_puts("softirqs     : print the softirq count and the irq-off time of every cpu\n");
+  uart_puts("timerbench   : arm and delete 10000 timers, print the cost\n");
+  uart_puts("timers       : print the timer irqs and the irqs saved by coalescing\n");
+  uart_puts("date         : print the time, 'date <sec>' sets the wall clock\n");
+  uart_puts("irqs         : print the count and handler time of every irq\n");
+  uart_puts("irqhist      : print the irq latency and irq-off time histograms\n");
+  uart_puts("uartstat     : print the uart interrupts per KB\n");
+  uart_puts("dmesg        : print the kernel log\n");
+  uart_puts("loglevel [n] : print or set the console loglevel\n");
 }
 
 
@@ -152,30 +171,42 @@ void TestTimeOut(char buf[MAX_SIZE]){
 void ls_arg(char *buf){
   char *path = strchr(buf, ' ') + 1;
   if(strlen(path) == 0){
+    spin_lock(&vfs_lock);
     vfs_ls(NULL);
+    spin_unlock(&vfs_lock);
   }
   else{
+    spin_lock(&vfs_lock);
     vfs_ls(path);
+    spin_unlock(&vfs_lock);
   }
 }
 
 void chdir_arg(char *buf){
   char *path = strchr(buf, ' ') + 1;
   if(strlen(path) == 0){
+    spin_lock(&vfs_lock);
     vfs_chdir(NULL);
+    spin_unlock(&vfs_lock);
   }
   else{
+    spin_lock(&vfs_lock);
     vfs_chdir(path);
+    spin_unlock(&vfs_lock);
   }
 }
 
 void mkdir_arg(char *buf){
   char *path = strchr(buf, ' ') + 1;
   if(strlen(path) == 0){
+    spin_lock(&vfs_lock);
     vfs_mkdir(NULL);
+    spin_unlock(&vfs_lock);
   }
   else{
+    spin_lock(&vfs_lock);
     vfs_mkdir(path);
+    spin_unlock(&vfs_lock);
   }
 }
 
@@ -189,16 +220,22 @@ void mount_arg(char *buf){
   strcpy(path, path_ptr);
   strcpy(fs_name, fs_name_ptr);
 
+  spin_lock(&vfs_lock);
   vfs_mount(path, fs_name);
+  spin_unlock(&vfs_lock);
 }
 
 void umount_arg(char *buf){
   char *path = strchr(buf, ' ') + 1;
   if(strlen(path) == 0){
+    spin_lock(&vfs_lock);
     vfs_umount(NULL);
+    spin_unlock(&vfs_lock);
   }
   else{
+    spin_lock(&vfs_lock);
     vfs_umount(path);
+    spin_unlock(&vfs_lock);
   }
 }
 
@@ -213,6 +250,26 @@ void exec_arg(char *buf){
   }
 }
 
+/* run the program in a child thread, the shell sleeps until it exits */
+void run_arg(char *buf){
+  char *path = strchr(buf, ' ') + 1;
+  int pid = kernel_spawn(path);
+  if(pid < 0){
+    uart_puts("[x] Failed to run the file\n");
+    return;
+  }
+  int status = 0;
+  wait_child(pid, &status, 0);
+  print_string(UITOA, "[*] pid ", pid, 0);
+  print_string(ITOA, " exited with status ", status, 1);
+}
+
+/* the fork/exec benchmark with the program */
+void sched_bench_arg(char *buf){
+  char *path = strchr(buf, ' ') + 1;
+  sched_bench(path);
+}
+
 /* Main Shell */
 void ShellLoop(){
   char buf[MAX_SIZE];
@@ -243,6 +300,22 @@ void ShellLoop(){
     else if(strncmp("mount", buf, strlen("mount")) == 0) mount_arg(buf);
     else if(strncmp("umount", buf, strlen("umount")) == 0) umount_arg(buf);
     else if(strncmp("exec", buf, strlen("exec")) == 0) exec_arg(buf);
+    else if(strncmp("run ", buf, strlen("run ")) == 0) run_arg(buf);
+    else if(strcmp("ps", buf) == 0) print_run_thread();
+    else if(strncmp("sched_bench ", buf, strlen("sched_bench ")) == 0) sched_bench_arg(buf);
+    else if(strcmp("lockstat", buf) == 0) print_lockstat();
+    else if(strcmp("schedlat", buf) == 0) print_sched_latency();
+    else if(strcmp("top", buf) == 0) print_top();
+    else if(strcmp("workqueue", buf) == 0) print_workqueue();
+    else if(strcmp("softirqs", buf) == 0) print_softirq();
+    else if(strcmp("timerbench", buf) == 0) timer_bench(TIMER_BENCH_NUM);
+    else if(strcmp("timers", buf) == 0) print_timer_stat();
+    else if(strncmp("date", buf, strlen("date")) == 0) date_arg(buf);
+    else if(strcmp("irqs", buf) == 0) print_irqs();
+    else if(strcmp("irqhist", buf) == 0) print_irq_hist();
+    else if(strcmp("uartstat", buf) == 0) print_uart_stat();
+    else if(strcmp("dmesg", buf) == 0) print_dmesg();
+    else if(strncmp("loglevel", buf, strlen("loglevel")) == 0) loglevel_arg(buf);
     else PrintUnknown(buf);
     
     
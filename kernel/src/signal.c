@@ -6,25 +6,34 @@
 #include <uart.h>
 
 extern Thread *thread_pool;
-extern Thread *run_thread_head;
+Spinlock signal_lock;
+
+void signal_init(){
+    spin_lock_init(&signal_lock, "signal_lock");
+}
 
 void check_sig_queue(TrapFrame *trapFrame){
-    disable_irq();
+    unsigned long flags = spin_lock_irqsave(&signal_lock);
     Thread *current = get_current();
 
 
     // if(current->running_signal == 1)
-    //     goto ENABLE_IRQ;
+    //     goto UNLOCK;
     if(list_empty(&current->sig_queue_head.list)){
-        goto ENABLE_IRQ;
+        goto UNLOCK;
     }
     
     SignalInfo *sigInfo = (SignalInfo *)current->sig_queue_head.list.next;
     if(sigInfo->ready > 0){
         sigInfo->ready = 0;
-        /* call the default handler(do_exit(0)) */
+        list_del(&sigInfo->list);
+        /* call the default handler(do_exit(0)), it doesn't return, release the lock first */
         if(sigInfo->handler == sig_default_handler){
+            spin_unlock_irqrestore(&signal_lock, flags);
+            if(sigInfo == &current->sig_info_pool[SIGCHLD])
+                return;
             sigInfo->handler(); 
+            return;
         }
         /* if not default handler, call the user signal handler */
         else{
@@ -36,10 +45,9 @@ void check_sig_queue(TrapFrame *trapFrame){
             trapFrame->elr_el1 = (unsigned long)sig_register_handler;
             trapFrame->sp_el0 = (unsigned long)current->sig_stack_addr + STACK_SIZE;
         }
-        list_del(&sigInfo->list);
     }
-ENABLE_IRQ:
-    enable_irq();
+UNLOCK:
+    spin_unlock_irqrestore(&signal_lock, flags);
 }
 
 
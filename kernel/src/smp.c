@@ -0,0 +1,78 @@
+#include <smp.h>
+#include <mmu.h>
+#include <sched.h>
+#include <uart.h>
+#include <string.h>
+#include <timer.h>
+#include <irq.h>
+
+Cpu cpus[NR_CPUS];
+/* the boot stacks of core 1-3 (start.S), later their idle threads */
+unsigned char secondary_stacks[NR_CPUS - 1][SECONDARY_STACK_SIZE] __attribute__((aligned(16)));
+
+static void set_cpu(Cpu *cpu){
+    asm volatile("msr tpidr_el1, %0\n\t" ::"r"(cpu));
+}
+
+/* core 0 sets its per-cpu data before anything calls get_current */
+void smp_init_boot_cpu(){
+    cpus[0].id = 0;
+    cpus[0].current = NULL;
+    cpus[0].idle = NULL;
+    cpus[0].resched_start = 0;
+    cpus[0].online = 1;
+    set_cpu(&cpus[0]);
+}
+
+/* 
+ * Release core 1-3 from the spin table one by one.
+ * Wait until the core is online before releasing the next one,
+ * so the boot messages are in order.
+ */
+void smp_boot_secondaries(){
+    unsigned long long frq, now, deadline;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+
+    for(unsigned int id = 1; id < NR_CPUS; id++){
+        cpus[id].id = id;
+        cpus[id].online = 0;
+        cpus[id].resched_start = 0;
+        volatile unsigned long *entry = (volatile unsigned long *)(unsigned long)(SPIN_TABLE_BASE + id * 8);
+        *entry = (unsigned long)secondary_start;
+        /* the core polls the spin table with the MMU off, push the entry out of the cache */
+        dcache_clean_range((const void *)entry, sizeof(*entry));
+        asm volatile("sev\n\t");
+
+        /* the firmware may not park the core in the spin table, give up after one second */
+        asm volatile("mrs %0, cntpct_el0\n\t" :"=r"(now));
+        deadline = now + frq;
+        while(!cpus[id].online && now < deadline){
+            asm volatile("mrs %0, cntpct_el0\n\t" :"=r"(now));
+        }
+        if(cpus[id].online)
+            print_string(UITOA, "[*] SMP: cpu online: ", id, 1);
+        else
+            print_string(UITOA, "[x] SMP: cpu failed to boot: ", id, 1);
+    }
+}
+
+/* C entry of core 1-3, running in EL1 on its own boot stack */
+void secondary_main(unsigned int id){
+    Cpu *cpu = &cpus[id];
+
+    set_cpu(cpu);
+    enable_el0_get_timer();
+
+    /* the boot context becomes the idle thread of this cpu */
+    cpu->idle = thread_init_current();
+
+    /* the scheduler tick of this cpu */
+    sched_timeout(NULL);
+    enable_timer_irq();
+
+    asm volatile("dmb sy\n\t");
+    cpu->online = 1;
+
+    enable_irq();
+    idle_thread();
+}
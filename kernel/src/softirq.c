@@ -0,0 +1,109 @@
+#include <softirq.h>
+#include <atomic.h>
+#include <workqueue.h>
+#include <sched.h>
+#include <irq.h>
+#include <uart.h>
+#include <string.h>
+#include <timer.h>
+
+extern Cpu cpus[NR_CPUS];
+
+static SoftirqHandler softirq_vec[NR_SOFTIRQS];
+static const char *softirq_name[NR_SOFTIRQS] = {"timer", "uart-rx", "uart-tx", "sched"};
+
+/* per-cpu stats */
+static unsigned long long softirq_count[NR_CPUS][NR_SOFTIRQS];
+static unsigned long long softirq_max_time[NR_CPUS]; // ticks of one do_softirq
+static unsigned int softirq_deferred[NR_CPUS]; // out of budget, passed to the kworker
+
+/* the rest of the pending vectors when do_softirq is out of budget */
+static Work softirq_work[NR_CPUS];
+
+static void softirq_work_func(void *args){
+    disable_irq();
+    do_softirq();
+    enable_irq();
+}
+
+void softirq_init(){
+    for(unsigned int i = 0; i < NR_CPUS; i++)
+        init_work(&softirq_work[i], softirq_work_func, NULL);
+    open_softirq(TIMER_SOFTIRQ, timer_softirq);
+    open_softirq(UART_RX_SOFTIRQ, uart_rx_softirq);
+    open_softirq(UART_TX_SOFTIRQ, uart_tx_softirq);
+    open_softirq(SCHED_SOFTIRQ, sched_softirq);
+}
+
+void open_softirq(int nr, SoftirqHandler handler){
+    softirq_vec[nr] = handler;
+}
+
+/* mark the vector pending on this cpu, it runs on the irq exit */
+void raise_softirq(int nr){
+    unsigned long flags = local_irq_save();
+    atomic_fetch_or32(&get_cpu()->softirq_pending, 1 << nr);
+    local_irq_restore(flags);
+}
+
+/* 
+ * Called with the irq disabled, the handlers run with the irq enabled.
+ * SOFTIRQ_OFFSET in preempt_count keeps the nested irq from running them again or preempting.
+ * A vector raised while running is picked up by the next round,
+ * out of the rounds or time, the rest is passed to the kworker.
+ */
+void do_softirq(){
+    Cpu *cpu = get_cpu();
+    Thread *curr_thread = cpu->current;
+    unsigned long long start, now, frq;
+    asm volatile("mrs %0, cntpct_el0\n\t" :"=r"(start));
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+
+    curr_thread->preempt_count += SOFTIRQ_OFFSET;
+    unsigned int restart = SOFTIRQ_MAX_RESTART;
+    unsigned int pending;
+    while((pending = atomic_xchg32(&cpu->softirq_pending, 0)) != 0){
+        enable_irq();
+        for(unsigned int nr = 0; nr < NR_SOFTIRQS; nr++){
+            if(!(pending & (1 << nr)) || softirq_vec[nr] == NULL) continue;
+            softirq_vec[nr]();
+            softirq_count[cpu->id][nr]++;
+        }
+        disable_irq();
+
+        asm volatile("mrs %0, cntpct_el0\n\t" :"=r"(now));
+        if(--restart == 0 || now - start > frq * SOFTIRQ_MAX_US / 1000000){
+            if(cpu->softirq_pending){
+                softirq_deferred[cpu->id]++;
+                queue_work_on(cpu->id, &softirq_work[cpu->id]);
+            }
+            break;
+        }
+    }
+    curr_thread->preempt_count -= SOFTIRQ_OFFSET;
+
+    asm volatile("mrs %0, cntpct_el0\n\t" :"=r"(now));
+    if(now - start > softirq_max_time[cpu->id])
+        softirq_max_time[cpu->id] = now - start;
+}
+
+void print_softirq(){
+    unsigned long long frq;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        if(!cpus[i].online) continue;
+        print_string(UITOA, "cpu", i, 0);
+        for(unsigned int nr = 0; nr < NR_SOFTIRQS; nr++){
+            uart_puts(" | ");
+            uart_puts((char *)softirq_name[nr]);
+            print_string(UITOA, ": ", softirq_count[i][nr], 0);
+        }
+        print_string(UITOA, " | deferred: ", softirq_deferred[i], 0);
+        print_string(UITOA, " | max time(us): ", softirq_max_time[i] * 1000000 / frq, 1);
+        /* the irq-masked part of the irq, the softirqs run with the irq enabled */
+        print_string(UITOA, "     hardirq: ", cpus[i].nr_hardirq, 0);
+        print_string(UITOA, " | max irq-off(us): ", cpus[i].hardirq_max * 1000000 / frq, 0);
+        print_string(UITOA, " | avg irq-off(ns): ",
+                    cpus[i].nr_hardirq ? cpus[i].hardirq_total / cpus[i].nr_hardirq * 1000000000 / frq : 0, 1);
+    }
+}
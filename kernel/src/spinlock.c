@@ -0,0 +1,126 @@
+#include <spinlock.h>
+#include <uart.h>
+#include <string.h>
+
+/* all the initialized locks, for print_lockstat */
+Spinlock *lock_table[MAX_LOCK_STAT];
+unsigned int lock_num = 0;
+Spinlock lock_table_lock;
+
+static inline unsigned long long read_cntpct(){
+    unsigned long long cnt;
+    asm volatile("isb\n\tmrs %0, cntpct_el0\n\t" :"=r"(cnt) ::"memory");
+    return cnt;
+}
+
+void spin_lock_init(Spinlock *lock, const char *name){
+    lock->slock = 0;
+    lock->name = name;
+    lock->acquired = 0;
+    lock->contended = 0;
+    lock->hold_start = 0;
+    lock->hold_max = 0;
+    lock->hold_total = 0;
+
+    if(lock == &lock_table_lock) return;
+    unsigned long flags = spin_lock_irqsave(&lock_table_lock);
+    /* the lock may be initialized again, register it once */
+    unsigned int idx;
+    for(idx = 0; idx < lock_num; idx++){
+        if(lock_table[idx] == lock) break;
+    }
+    if(idx == lock_num && lock_num < MAX_LOCK_STAT)
+        lock_table[lock_num++] = lock;
+    spin_unlock_irqrestore(&lock_table_lock, flags);
+}
+
+/*
+ * Take a ticket with ldaxr/stxr, then wait until the owner is our ticket.
+ * The lock word is in Normal memory (mmu_init/enable_mmu), stxr may never succeed on Device memory.
+ * The waiter sleeps in wfe, the stlrh in raw_spin_unlock wakes it up.
+ * The caller disables the preemption.
+ */
+void raw_spin_lock(Spinlock *lock){
+    unsigned int old, new, status;
+    asm volatile(
+        "   prfm pstl1strm, [%3]\n\t"
+        "1: ldaxr %w0, [%3]\n\t"
+        "   add %w1, %w0, %w4\n\t"
+        "   stxr %w2, %w1, [%3]\n\t"
+        "   cbnz %w2, 1b\n\t"
+        :"=&r"(old), "=&r"(new), "=&r"(status)
+        :"r"(&lock->slock), "r"(1 << 16)
+        :"memory"
+    );
+
+    unsigned int ticket = old >> 16;
+    if((old & 0xffff) != ticket){
+        unsigned int owner;
+        asm volatile(
+            "   sevl\n\t"
+            "1: wfe\n\t"
+            "   ldaxrh %w0, [%1]\n\t"
+            "   cmp %w0, %w2\n\t"
+            "   b.ne 1b\n\t"
+            :"=&r"(owner)
+            :"r"(&lock->slock), "r"(ticket)
+            :"memory", "cc"
+        );
+#if LOCK_STAT
+        lock->contended++;
+#endif
+    }
+
+#if LOCK_STAT
+    lock->acquired++;
+    lock->hold_start = read_cntpct();
+#endif
+}
+
+void raw_spin_unlock(Spinlock *lock){
+#if LOCK_STAT
+    unsigned long long hold = read_cntpct() - lock->hold_start;
+    if(hold > lock->hold_max) lock->hold_max = hold;
+    lock->hold_total += hold;
+#endif
+
+    /* only the holder changes the owner, pass the lock to the next ticket */
+    unsigned int owner;
+    asm volatile(
+        "ldrh %w0, [%1]\n\t"
+        "add %w0, %w0, 1\n\t"
+        "stlrh %w0, [%1]\n\t"
+        :"=&r"(owner)
+        :"r"(&lock->slock)
+        :"memory"
+    );
+}
+
+/* the thread holding a spinlock is not preempted */
+void spin_lock(Spinlock *lock){
+    preempt_disable();
+    raw_spin_lock(lock);
+}
+
+void spin_unlock(Spinlock *lock){
+    raw_spin_unlock(lock);
+    preempt_enable();
+}
+
+void print_lockstat(){
+    unsigned long long frq;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+
+    uart_puts("-------------------------- Lock Stat --------------------------\n");
+    for(unsigned int i = 0; i < lock_num; i++){
+        Spinlock *lock = lock_table[i];
+        print_string(UITOA, "[", i, 0);
+        uart_puts("] ");
+        uart_puts((char *)lock->name);
+        print_string(UITOA, " | acquired: ", lock->acquired, 0);
+        print_string(UITOA, " | contended: ", lock->contended, 0);
+        print_string(UITOA, " | max hold(us): ", lock->hold_max * 1000000 / frq, 0);
+        print_string(UITOA, " | avg hold(ns): ",
+                    lock->acquired ? lock->hold_total / lock->acquired * 1000000000 / frq : 0, 1);
+    }
+}
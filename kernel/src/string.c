@@ -17,6 +17,7 @@
 
 #include <string.h>
 #include <uart.h>
+#include <kprintf.h>
 
 
 /* Compare S1 and S2, returning less than, equal to or
@@ -115,26 +116,20 @@ void uitohex(char buf[MAX_SIZE], unsigned int d){
   reverse_string(buf);
 }
 
+/* one uart write for the text, the number and the newline, all 64 bits of num */
 void print_string(enum print_type type, char *text , unsigned long long num, int println){
-  char buf[20];
+  const char *nl = println ? "\n" : "";
   switch(type){
     case UITOHEX:
-      uart_puts(text);
-      uitohex(buf, (unsigned int)num);
-      uart_puts(buf);
+      kprintf("%s%llx%s", text, num, nl);
       break;
     case UITOA:
-      uart_puts(text);
-      uitoa(buf, (unsigned int)num);
-      uart_puts(buf);
+      kprintf("%s%llu%s", text, num, nl);
       break;
     case ITOA:
-      uart_puts(text);
-      itoa(buf, (int)num);
-      uart_puts(buf);
+      kprintf("%s%lld%s", text, (long long)num, nl);
       break;
   }
-  if(println) uart_puts("\n");
 }
 
 /* array to int */
@@ -13,12 +13,14 @@
 #include <signal.h>
 #include <vfs.h>
 #include <tmpfs.h>
+#include <smp.h>
+#include <user_syscall.h>
+#include <vdso.h>
+#include <io_ring.h>
+#include <mmu.h>
 
 extern Thread *thread_pool;
-extern Thread *run_thread_head;
-extern File **global_fd_table;
-extern char *global_dir;
-extern Dentry *global_dentry;
+extern Cpu cpus[NR_CPUS];
 
 /* 
  * Return value is x0
@@ -28,54 +30,43 @@ extern Dentry *global_dentry;
 
 /* Get current process’s id. */
 void sys_getpid(TrapFrame *trapFrame){
-    disable_irq();
     int pid = do_getpid();
     trapFrame->x[0] = pid;
-    enable_irq();
 }
 int do_getpid(){
     return get_current()->id;
 }
 
+/* the full path of a syscall without the work, for the latency benchmark */
+void sys_null(TrapFrame *trapFrame){
+    trapFrame->x[0] = 0;
+}
+
 /* Return the number of bytes read by reading size byte into the user-supplied buffer buf. */
 void sys_uart_read(TrapFrame *trapFrame){
-    disable_irq();
     char *buf = (char *)trapFrame->x[0];
     unsigned int size = trapFrame->x[1];
-    enable_irq();
     int idx = async_readnbyte(buf, size);
-    disable_irq();
     trapFrame->x[0] = idx;
-    enable_irq();
 }
 
 /* Return the number of bytes written after writing size byte from the user-supplied buffer buf. */
 void sys_uart_write(TrapFrame *trapFrame){
-    disable_irq();
     const char *buf = (char *)trapFrame->x[0];
     unsigned int size = trapFrame->x[1];
-    unsigned int i;
-    enable_irq();
-    for(i = 0; i < size; i++){
-        uart_putc(buf[i]);
-    }
-    disable_irq();
-    trapFrame->x[0] = i;
-    enable_irq();
+    /* queued in the tx ring, it only blocks when the ring is full */
+    trapFrame->x[0] = async_uart_write(buf, size, 0);
 }
+
 void sys_exec(TrapFrame *trapFrame){
-    disable_irq();
     const char *name = (const char *)trapFrame->x[0];
     char **const argv = (char **const)trapFrame->x[1];
     int success = do_exec(trapFrame, name, argv);
-    disable_irq();
     trapFrame->x[0] = success;
-    enable_irq();
 }
 
 
 int do_exec(TrapFrame *trapFrame, const char *name, char *const argv[]){
-    disable_irq();
     /* check if the file info exist */
     // file_info fileInfo = cpio_find_file_info(name);
     // if(fileInfo.filename == NULL) return -1;
@@ -96,6 +87,7 @@ int do_exec(TrapFrame *trapFrame, const char *name, char *const argv[]){
 
 
     /* maybe need to reset the signal 0.0? */
+    unsigned long flags = spin_lock_irqsave(&signal_lock);
     for(unsigned int i = 0; i < MAX_SIG_HANDLER; i++){
         curr_thread->sig_info_pool[i].ready = 0;
         curr_thread->sig_info_pool[i].handler = sig_default_handler;
@@ -108,21 +100,30 @@ int do_exec(TrapFrame *trapFrame, const char *name, char *const argv[]){
         kfree(curr_thread->old_tp);
     curr_thread->sig_stack_addr = NULL;
     curr_thread->old_tp = NULL;
+    spin_unlock_irqrestore(&signal_lock, flags);
+
+    /* the new program doesn't inherit the fp/simd registers */
+    fpsimd_flush_thread(curr_thread);
+    /* nor the io ring, its addresses are of the old program */
+    io_ring_free(curr_thread);
 
     /* reset the vfs info, except stdin, stdout, stderr */
+    spin_lock(&vfs_lock);
     for(int i = 3; i < MAX_FD_NUM; i++){
         if(curr_thread->fd_table[i] != NULL){
             vfs_close(curr_thread->fd_table[i]);
             curr_thread->fd_table[i] = NULL;
         }
     }
+    spin_unlock(&vfs_lock);
 
-    enable_irq();
     return 0;
 }
 
+static void enter_user_program(Thread *thread);
+static void copy_fd_table(Thread *new_thread);
+
 int kernel_exec(char *name){
-    disable_irq();
     /* check if the file info exist */
     // file_info fileInfo = cpio_find_file_info(name);
     // if(fileInfo.filename == NULL) return -1;
@@ -132,57 +133,98 @@ int kernel_exec(char *name){
     void *thread_code_addr = vfs_load_program(name, &file_size); 
     if(thread_code_addr == NULL) return -1;
 
-    Thread *new_thread = thread_create(thread_code_addr);
+    /* 
+     * exec in the current thread (the shell), it keeps its pid, dir and fd table.
+     * the thread from thread_init_current has no stacks, allocate them here.
+     */
+    Thread *new_thread = get_current();
+    if(new_thread->ustack_addr == NULL)
+        new_thread->ustack_addr = kmalloc(STACK_SIZE);
+    if(new_thread->kstack_addr == NULL)
+        new_thread->kstack_addr = kmalloc(STACK_SIZE);
     new_thread->code_addr = thread_code_addr;
     new_thread->code_size = file_size;
+    fpsimd_flush_thread(new_thread);
     print_string(UITOHEX, "[*] kernel_exec: new_thread->code_addr: 0x", (unsigned long long)new_thread->code_addr, 1);
 
-    /* copy the golbal dir / dentry in the new_thread*/
-    strcpy(new_thread->dir, global_dir);
-    new_thread->dentry = global_dentry;
-    /* copy fd table */
-    for(int i = 0; i < MAX_FD_NUM; i++){
-        new_thread->fd_table[i] = global_fd_table[i];
-    }
-
     // set_period_timer_irq();
-    sched_timeout("omg");
-    enable_irq();
+    enter_user_program(new_thread);
+    return 0; 
+}
+
+/* run the program of the thread in el0 with empty stacks, it doesn't return */
+static void enter_user_program(Thread *thread){
+    /* no irq between setting elr_el1/spsr_el1 and eret, eret unmasks it in el0 */
+    disable_irq();
     asm volatile(
         "mov x0, 0x0\n\t"
         "msr spsr_el1, x0\n\t"
-        "msr tpidr_el1, %0\n\t"
-        "msr elr_el1, %1\n\t"
-        "msr sp_el0, %2\n\t"
-        "mov sp, %3\n\t"
+        "msr elr_el1, %0\n\t"
+        "msr sp_el0, %1\n\t"
+        "mov sp, %2\n\t"
         "eret\n\t"
-        ::"r"(new_thread),
-        "r"(new_thread->code_addr),
-        "r"(new_thread->ustack_addr + STACK_SIZE),
-        "r"(new_thread->kstack_addr + STACK_SIZE)
+        ::"r"(thread->code_addr),
+        "r"(thread->ustack_addr + STACK_SIZE),
+        "r"(thread->kstack_addr + STACK_SIZE)
         : "x0"
     );
-    return 0; 
+}
+
+static void spawn_entry(){
+    enter_user_program(get_current());
+}
+
+/* 
+ * Run the program in a new child thread of the current thread,
+ * the caller can wait for it with wait_child. Return the child pid.
+ */
+int kernel_spawn(char *name){
+    unsigned long file_size;
+    void *thread_code_addr = vfs_load_program(name, &file_size);
+    if(thread_code_addr == NULL) return -1;
+
+    Thread *new_thread = thread_alloc(spawn_entry);
+    if(new_thread == NULL){
+        kfree(thread_code_addr);
+        return -1;
+    }
+    Thread *curr_thread = get_current();
+    new_thread->cpus_allowed = curr_thread->cpus_allowed;
+    new_thread->code_addr = thread_code_addr;
+    new_thread->code_size = file_size;
+    copy_fd_table(new_thread);
+    thread_set_parent(new_thread, curr_thread);
+    wake_up_new_thread(new_thread);
+    return new_thread->id;
 }
 
 void *cpio_load_program(file_info *fileInfo){
     void *thread_code_addr = kmalloc(fileInfo->datasize);
     if(thread_code_addr == NULL) return NULL;
     memcpy(thread_code_addr, fileInfo->data, fileInfo->datasize);
+    sync_icache_range(thread_code_addr, fileInfo->datasize);
     return thread_code_addr;
 }
 
 void *vfs_load_program(const char *pathname, unsigned long *size){
     File *file;
+    spin_lock(&vfs_lock);
     int err = vfs_open(pathname, 0, &file);
-    if(err < 0) return NULL;
+    if(err < 0){
+        spin_unlock(&vfs_lock);
+        return NULL;
+    }
     TmpfsInode *inode_head = (TmpfsInode *)file->vnode->internal;
     void *thread_code_addr = kmalloc(inode_head->size);
-    if(thread_code_addr == NULL) return NULL;
+    if(thread_code_addr == NULL){
+        spin_unlock(&vfs_lock);
+        return NULL;
+    }
     int read_size = vfs_read(file, thread_code_addr, inode_head->size);
     if(read_size < 0){
         kfree(thread_code_addr);
         thread_code_addr = NULL;
+        spin_unlock(&vfs_lock);
         uart_puts("[x] vfs_load_program: load program error\n");
         return NULL;
     }
@@ -205,28 +247,46 @@ void *vfs_load_program(const char *pathname, unsigned long *size){
     //     uart_puts("[x] vfs_load_program: load program error\n");
     //     return NULL;
     // } 
+    /* the program runs from the copy, the caches are on (mmu.h) */
+    sync_icache_range(thread_code_addr, inode_head->size);
     *size = inode_head->size;
     vfs_close(file);
+    spin_unlock(&vfs_lock);
     return thread_code_addr;
 }
 
 
 void sys_fork(TrapFrame *trapFrame){
-    disable_irq();
     int child_pid = do_fork(trapFrame);
-    disable_irq();
     trapFrame->x[0] = child_pid;
-    enable_irq();
+}
+
+/* the child gets its own copy of every opened file of the current thread */
+static void copy_fd_table(Thread *new_thread){
+    for(int i = 0; i < MAX_FD_NUM; i++){
+        File *tmp = global_fd_table[i];
+        if(tmp != NULL){
+            File *new_file = kmalloc(sizeof(File));
+            new_file->f_ops = tmp->f_ops;
+            new_file->f_pos = tmp->f_pos;
+            new_file->vnode = tmp->vnode;
+            new_file->flags = tmp->flags;
+            new_thread->fd_table[i] = new_file;
+        }
+    }
 }
 
 int do_fork(TrapFrame *trapFrame){
-    disable_irq();
     Thread *curr_thread = get_current();
 
     // void *thread_code_addr = kmalloc(curr_thread->code_size);
     // if(thread_code_addr == NULL) return -1;
 
-    Thread *new_thread = thread_create(curr_thread->code_addr);
+    Thread *new_thread = thread_alloc(curr_thread->code_addr);
+    if(new_thread == NULL)
+        return -1;
+    new_thread->cpus_allowed = curr_thread->cpus_allowed;
+    thread_set_parent(new_thread, curr_thread);
     new_thread->code_addr = curr_thread->code_addr;
     new_thread->code_size = curr_thread->code_size;
 
@@ -243,30 +303,24 @@ int do_fork(TrapFrame *trapFrame){
     memcpy((char *)&new_thread->ctx, (char *)&curr_thread->ctx, sizeof(CpuContext));
 
     /* copy signal */
+    unsigned long flags = spin_lock_irqsave(&signal_lock);
     memcpy((char *)&new_thread->sig_info_pool, (char *)&curr_thread->sig_info_pool, MAX_SIG_HANDLER * sizeof(SignalInfo));
     for(unsigned int i = 0; i < MAX_SIG_HANDLER; i++){
         if(new_thread->sig_info_pool[i].ready > 0){
             list_add_tail(&new_thread->sig_info_pool[i].list, &new_thread->sig_queue_head.list);
         }
     }
+    spin_unlock_irqrestore(&signal_lock, flags);
+
+    /* copy fp/simd */
+    fpsimd_fork(curr_thread, new_thread);
 
     /* copy the golbal dir / dentry in the new_thread*/
     strcpy(new_thread->dir, global_dir);
     new_thread->dentry = global_dentry;
 
 
-    /* copy fd table */
-    for(int i = 0; i < MAX_FD_NUM; i++){
-        File *tmp = global_fd_table[i];
-        if(tmp != NULL){
-            File *new_file = kmalloc(sizeof(File));
-            new_file->f_ops = tmp->f_ops;
-            new_file->f_pos = tmp->f_pos;
-            new_file->vnode = tmp->vnode;
-            new_file->flags = tmp->flags;
-            new_thread->fd_table[i] = new_file;
-        }
-    }
+    copy_fd_table(new_thread);
 
 
     // print_string(UITOHEX, "(child)new_thread->code_addr: 0x", (unsigned long long)new_thread->code_addr, 1);
@@ -285,64 +339,68 @@ int do_fork(TrapFrame *trapFrame){
    
 
     /* after context switch, child proc will load all reg from kernel stack, and return to el0 */
-    new_thread->ctx.lr = (unsigned long)after_fork;
+    new_thread->ctx.lr = (unsigned long)ret_from_fork;
     new_thread->ctx.sp = (unsigned long)new_trapFrame;
-    enable_irq();
+    /* the child is ready, put it in the runqueue */
+    wake_up_new_thread(new_thread);
     return new_thread->id;
 }
 
 void sys_exit(TrapFrame *trapFrame){
-    disable_irq();
     int status = trapFrame->x[0];
     do_exit(status);
 }
+
 /* Terminate the current process. */
 void do_exit(int status){
+    /* mask the irq of this cpu, the timer can't schedule it out before it is a zombie */
     disable_irq();
 
     Thread *exit_thread = get_current();
-    exit_thread->state = EXIT;
+    thread_to_zombie(exit_thread, status);
     
     enable_irq();
     schedule();
 }
 
 void sys_mbox_call(TrapFrame *trapFrame){
-    disable_irq();
     unsigned char ch = trapFrame->x[0];
     unsigned int *mbox = (unsigned int *)trapFrame->x[1];
     int status = mailbox_call(mbox, ch);
     trapFrame->x[0] = status;
-    enable_irq();
 }
 
 
 void sys_kill(TrapFrame *trapFrame){
-    disable_irq();
     int pid = trapFrame->x[0];
     int status = do_kill(pid);
     if(status == -1) 
         print_string(UITOA, "[x] kill fail, pid: ", pid, 1);
     else
         print_string(UITOA, "[*] kill success, pid: ", pid, 1);
-
-    enable_irq();
 }
 
 int do_kill(int pid){
     if(!(pid >= 0 && pid < MAX_THREAD))
         return -1;
-    if(thread_pool[pid].state != RUNNING)
+    if(!thread_is_alive(&thread_pool[pid]))
+        return -1;
+    /* the idle thread of a cpu can't be killed */
+    if(&thread_pool[pid] == cpus[thread_pool[pid].cpu].idle)
         return -1;
 
-    thread_pool[pid].state = EXIT;
+    disable_irq();
+    /* another thread may kill it at the same time */
+    if(thread_to_zombie(&thread_pool[pid], EXIT_CODE_KILLED) == -1){
+        enable_irq();
+        return -1;
+    }
     enable_irq();
     schedule();
     return 0;
 }
 
 void sys_signal_register(TrapFrame *trapFrame){
-    disable_irq();
     int signal = trapFrame->x[0];
     SigHandler handler = (SigHandler)trapFrame->x[1];
     int status = do_signal_register(signal, handler);
@@ -350,7 +408,6 @@ void sys_signal_register(TrapFrame *trapFrame){
         print_string(UITOA, "[x] signal register fail, signal: ", signal, 1);
     // else
         // print_string(UITOA, "[*] signal register success, signal: ", signal, 1);
-    enable_irq();
 }
 
 int do_signal_register(int signal, SigHandler handler){
@@ -358,12 +415,13 @@ int do_signal_register(int signal, SigHandler handler){
     if(!(signal >= 0 && signal < MAX_SIG_HANDLER))
         return -1;
     
+    unsigned long flags = spin_lock_irqsave(&signal_lock);
     curr_thread->sig_info_pool[signal].handler = handler;
+    spin_unlock_irqrestore(&signal_lock, flags);
     return 0;
 }
 
 void sys_signal_kill(TrapFrame *trapFrame){
-    disable_irq();
     int pid = trapFrame->x[0];
     int signal = trapFrame->x[1];
     int status = do_signal_kill(pid, signal);
@@ -372,29 +430,29 @@ void sys_signal_kill(TrapFrame *trapFrame){
         print_string(UITOA, "[x] signal_kill fail, pid: ", pid, 1);
     // else
     //     print_string(UITOA, "[*] signal_kill ready, pid: ", pid, 1);
-
-    enable_irq();
 }
 
 int do_signal_kill(int pid, int signal){
     if(!(pid >= 0 && pid < MAX_THREAD))
         return -1;
-    if(thread_pool[pid].state != RUNNING)
+    if(!thread_is_alive(&thread_pool[pid]))
         return -1;
 
     /* 
      * add the signal to the thread's ready queue 
      * if ther signal isn't in ready queue, add it.
      */
+    unsigned long flags = spin_lock_irqsave(&signal_lock);
     if(thread_pool[pid].sig_info_pool[signal].ready == 0){
         list_add_tail(&thread_pool[pid].sig_info_pool[signal].list, &thread_pool[pid].sig_queue_head.list);
     }
     thread_pool[pid].sig_info_pool[signal].ready++;
+    spin_unlock_irqrestore(&signal_lock, flags);
     return 0;    
 }
 
 void sys_sigreturn(TrapFrame *trapFrame){
-    disable_irq();
+    unsigned long flags = spin_lock_irqsave(&signal_lock);
     Thread *current = get_current();
     /* load the old trap frame */
     memcpy((char *)trapFrame, (char *)current->old_tp, sizeof(TrapFrame));
@@ -402,175 +460,320 @@ void sys_sigreturn(TrapFrame *trapFrame){
     kfree(current->old_tp);
     current->sig_stack_addr = NULL;
     current->old_tp = NULL;
-
-    enable_irq();
+    spin_unlock_irqrestore(&signal_lock, flags);
 }
 
 void sys_open(TrapFrame *trapFrame){
-    disable_irq();
-    char *path = (char *)trapFrame->x[0];
+    const char *path = (const char *)trapFrame->x[0];
     int flags = trapFrame->x[1];
+    trapFrame->x[0] = do_open(path, flags);
+}
 
+int do_open(const char *path, int flags){
     File *file = NULL;
+    spin_lock(&vfs_lock);
     int status = vfs_open(path, flags, &file);
-    unsigned int fd_idx = 0;
-    if(status == 0){
-        for(;fd_idx < MAX_FD_NUM; fd_idx++){
-            if(global_fd_table[fd_idx] == NULL){
-                global_fd_table[fd_idx] = file;
-                trapFrame->x[0] = fd_idx;
-                return;
-            }
+    spin_unlock(&vfs_lock);
+    if(status != 0)
+        return status;
+    for(unsigned int fd_idx = 0; fd_idx < MAX_FD_NUM; fd_idx++){
+        if(global_fd_table[fd_idx] == NULL){
+            global_fd_table[fd_idx] = file;
+            return fd_idx;
         }
-        kfree(file);
-        file = NULL;
-        trapFrame->x[0] = -1;
     }
-    else 
-        trapFrame->x[0] = status;
-    enable_irq();
+    kfree(file);
+    return -1;
 }
 
 void sys_close(TrapFrame *trapFrame){
-    disable_irq();
     int fd = trapFrame->x[0];
+    trapFrame->x[0] = do_close(fd);
+}
 
+int do_close(int fd){
     if(fd < 0 || fd >= MAX_FD_NUM)
-        trapFrame->x[0] = -1;
-    else if(global_fd_table[fd] == NULL)
-        trapFrame->x[0] = -1;
-    else{
-        int status = vfs_close(global_fd_table[fd]);
-        if(status == 0) global_fd_table[fd] = NULL;
-        trapFrame->x[0] = status;
-    }
-    enable_irq();
+        return -1;
+    if(global_fd_table[fd] == NULL)
+        return -1;
+    spin_lock(&vfs_lock);
+    int status = vfs_close(global_fd_table[fd]);
+    spin_unlock(&vfs_lock);
+    if(status == 0) global_fd_table[fd] = NULL;
+    return status;
 }
 
 void sys_write(TrapFrame *trapFrame){
-    disable_irq();
     int fd = trapFrame->x[0];
-    char *buf = (char *)trapFrame->x[1];
+    const char *buf = (const char *)trapFrame->x[1];
     int count = trapFrame->x[2];
-    int status;
-
-    if(fd < 0 || fd >= MAX_FD_NUM){
-        trapFrame->x[0] = -1;
-        goto DONE;
-    }   
-        
-    if(global_fd_table[fd] == NULL){
-        trapFrame->x[0] = -1;
-        goto DONE;
-    }   
-
-    /* FIFO: uart file */
-    // if(fd == 1 || fd == 2){
-    //     /* stdout, write the data in uart file */
-    //     status = vfs_write(global_fd_table[fd], buf, count);
-    //     if(status < 0){
-    //         trapFrame->x[0] = status;
-    //         goto DONE;
-    //     }
-    //     /* reset the pos */
-    //     vfs_lseek64(global_fd_table[fd], 0, SEEK_SET);
-
-    //     /* stdin, read the data to the terminal */
-    //     size_t thesize = 0;
-    //     char buf2[MAX_SIZE];
-    //     int read_size;
-    //     while(1){
-    //         memset(buf2, 0, MAX_SIZE);
-    //         read_size = vfs_read(global_fd_table[fd], buf2, MAX_SIZE - 1);
-    //         if(read_size <= 0){
-    //             break;
-    //         } 
-    //         thesize += read_size;
-    //         uart_puts(buf2);
-    //     }
-    //     vfs_lseek64(global_fd_table[fd], 0, SEEK_SET);
-    //     trapFrame->x[0] = thesize;
-    //     goto DONE;
-    // }
+    trapFrame->x[0] = do_write(fd, buf, count);
+}
 
-    /* normal file */
-    status = vfs_write(global_fd_table[fd], buf, count);
-    trapFrame->x[0] = status;
+int do_write(int fd, const char *buf, int count){
+    if(fd < 0 || fd >= MAX_FD_NUM)
+        return -1;
+    if(global_fd_table[fd] == NULL)
+        return -1;
 
-DONE:
-    enable_irq();
+    /* normal file */
+    File *file = global_fd_table[fd];
+    int dev = vfs_is_dev(file);
+    if(!dev) spin_lock(&vfs_lock);
+    int status = vfs_write(file, buf, count);
+    if(!dev) spin_unlock(&vfs_lock);
+    return status;
 }
 
 void sys_read(TrapFrame *trapFrame){
-    disable_irq();
     int fd = trapFrame->x[0];
     char *buf = (char *)trapFrame->x[1];
     int count = trapFrame->x[2];
+    trapFrame->x[0] = do_read(fd, buf, count);
+}
+
+int do_read(int fd, char *buf, int count){
+    if(fd < 0 || fd >= MAX_FD_NUM)
+        return -1;
+    if(global_fd_table[fd] == NULL)
+        return -1;
+    /* the uart read blocks until the input comes, don't hold vfs_lock */
+    File *file = global_fd_table[fd];
+    int dev = vfs_is_dev(file);
+    if(!dev) spin_lock(&vfs_lock);
+    int status = vfs_read(file, buf, count);
+    if(!dev) spin_unlock(&vfs_lock);
+    return status;
+}
 
+/* the segments in order under one vfs_lock, stop at the first short one */
+void sys_readv(TrapFrame *trapFrame){
+    int fd = trapFrame->x[0];
+    const struct iovec *iov = (const struct iovec *)trapFrame->x[1];
+    int iovcnt = trapFrame->x[2];
+    trapFrame->x[0] = do_readv(fd, iov, iovcnt);
+}
+
+long do_readv(int fd, const struct iovec *iov, int iovcnt){
     if(fd < 0 || fd >= MAX_FD_NUM)
-        trapFrame->x[0] = -1;
-    else if(global_fd_table[fd] == NULL)
-        trapFrame->x[0] = -1;
-    else{
-        /* stdin */
-        // if(fd == 0){
-        //     enable_irq();
-        //     int idx = async_readnbyte(buf, count);
-        //     disable_irq();
-        //     int status = vfs_write(global_fd_table[0], buf, idx);
-        //     vfs_lseek64(global_fd_table[0], 0, SEEK_SET);
-        //     trapFrame->x[0] = status;
-        //     goto DONE;
-            
-        //     // trapFrame->x[0] = idx;
-        //     // goto DONE;
-        // }
-        int status = vfs_read(global_fd_table[fd], buf, count);
-        trapFrame->x[0] = status;
+        return -1;
+    if(global_fd_table[fd] == NULL || iov == NULL || iovcnt < 0 || iovcnt > UIO_MAXIOV)
+        return -1;
+    File *file = global_fd_table[fd];
+    int dev = vfs_is_dev(file);
+    long total = 0;
+    if(!dev) spin_lock(&vfs_lock);
+    for(int i = 0; i < iovcnt; i++){
+        int status = vfs_read(file, iov[i].iov_base, iov[i].iov_len);
+        if(status < 0){
+            /* the error only when nothing is read */
+            if(total == 0) total = -1;
+            break;
+        }
+        total += status;
+        if((size_t)status < iov[i].iov_len) break;
     }
-    
-    enable_irq();
+    if(!dev) spin_unlock(&vfs_lock);
+    return total;
+}
+
+void sys_writev(TrapFrame *trapFrame){
+    int fd = trapFrame->x[0];
+    const struct iovec *iov = (const struct iovec *)trapFrame->x[1];
+    int iovcnt = trapFrame->x[2];
+    trapFrame->x[0] = do_writev(fd, iov, iovcnt);
+}
+
+long do_writev(int fd, const struct iovec *iov, int iovcnt){
+    if(fd < 0 || fd >= MAX_FD_NUM)
+        return -1;
+    if(global_fd_table[fd] == NULL || iov == NULL || iovcnt < 0 || iovcnt > UIO_MAXIOV)
+        return -1;
+    File *file = global_fd_table[fd];
+    int dev = vfs_is_dev(file);
+    long total = 0;
+    if(!dev) spin_lock(&vfs_lock);
+    for(int i = 0; i < iovcnt; i++){
+        int status = vfs_write(file, iov[i].iov_base, iov[i].iov_len);
+        if(status < 0){
+            if(total == 0) total = -1;
+            break;
+        }
+        total += status;
+        if((size_t)status < iov[i].iov_len) break;
+    }
+    if(!dev) spin_unlock(&vfs_lock);
+    return total;
+}
+
+/* read/write at offset, the file position is not changed */
+void sys_pread64(TrapFrame *trapFrame){
+    int fd = trapFrame->x[0];
+    char *buf = (char *)trapFrame->x[1];
+    int count = trapFrame->x[2];
+    long offset = trapFrame->x[3];
+    trapFrame->x[0] = do_pread64(fd, buf, count, offset);
+}
+
+int do_pread64(int fd, char *buf, int count, long offset){
+    if(fd < 0 || fd >= MAX_FD_NUM)
+        return -1;
+    if(global_fd_table[fd] == NULL)
+        return -1;
+    spin_lock(&vfs_lock);
+    int status = vfs_pread(global_fd_table[fd], buf, count, offset);
+    spin_unlock(&vfs_lock);
+    return status;
+}
+
+void sys_pwrite64(TrapFrame *trapFrame){
+    int fd = trapFrame->x[0];
+    const char *buf = (const char *)trapFrame->x[1];
+    int count = trapFrame->x[2];
+    long offset = trapFrame->x[3];
+    trapFrame->x[0] = do_pwrite64(fd, buf, count, offset);
+}
+
+int do_pwrite64(int fd, const char *buf, int count, long offset){
+    if(fd < 0 || fd >= MAX_FD_NUM)
+        return -1;
+    if(global_fd_table[fd] == NULL)
+        return -1;
+    spin_lock(&vfs_lock);
+    int status = vfs_pwrite(global_fd_table[fd], buf, count, offset);
+    spin_unlock(&vfs_lock);
+    return status;
 }
 
 void sys_mkdir(TrapFrame *trapFrame){
-    disable_irq();
     char *path = (char *)trapFrame->x[0];
     // int mode = trapFrame->x[1];
+    spin_lock(&vfs_lock);
     int status = vfs_mkdir(path);
+    spin_unlock(&vfs_lock);
     trapFrame->x[0] = status;
-    enable_irq();
 }
 
 void sys_mount(TrapFrame *trapFrame){
-    disable_irq();
     char *path = (char *)trapFrame->x[1];
     char *fsname = (char *)trapFrame->x[2];
+    spin_lock(&vfs_lock);
     int status = vfs_mount(path, fsname);
+    spin_unlock(&vfs_lock);
     trapFrame->x[0] = status;
-    enable_irq();
 }
 
 void sys_chdir(TrapFrame *trapFrame){
-    disable_irq();
     char *path = (char *)trapFrame->x[0];
+    spin_lock(&vfs_lock);
     int status = vfs_chdir(path);
+    spin_unlock(&vfs_lock);
     trapFrame->x[0] = status;
-    enable_irq();
 }
 
 void sys_lseek64(TrapFrame *trapFrame){
-    disable_irq();
     int fd = trapFrame->x[0];
-    int offset = trapFrame->x[1];
+    long offset = trapFrame->x[1];
     int whence = trapFrame->x[2];
-    // uart_puts("lseek64\n");
-    int status = vfs_lseek64(global_fd_table[fd], offset, whence);
-    trapFrame->x[0] = status;
-    enable_irq();
+    trapFrame->x[0] = do_lseek64(fd, offset, whence);
+}
+
+long do_lseek64(int fd, long offset, int whence){
+    if(fd < 0 || fd >= MAX_FD_NUM)
+        return -1;
+    if(global_fd_table[fd] == NULL)
+        return -1;
+    spin_lock(&vfs_lock);
+    long status = vfs_lseek64(global_fd_table[fd], offset, whence);
+    spin_unlock(&vfs_lock);
+    return status;
 }
 
 void sys_ioctl(TrapFrame *trapFrame){
-    disable_irq();
+    
+}
 
-    enable_irq();
-}
\ No newline at end of file
+void sys_sched_setaffinity(TrapFrame *trapFrame){
+    int pid = trapFrame->x[0];
+    unsigned int mask = trapFrame->x[1];
+    int status = do_sched_setaffinity(pid, mask);
+    trapFrame->x[0] = status;
+}
+
+void sys_sched_getaffinity(TrapFrame *trapFrame){
+    int pid = trapFrame->x[0];
+    trapFrame->x[0] = do_sched_getaffinity(pid);
+}
+
+void sys_thread_stat(TrapFrame *trapFrame){
+    int pid = trapFrame->x[0];
+    ThreadStat *stat = (ThreadStat *)trapFrame->x[1];
+    trapFrame->x[0] = do_thread_stat(pid, stat);
+}
+
+void sys_nanosleep(TrapFrame *trapFrame){
+    const struct timespec *req = (const struct timespec *)trapFrame->x[0];
+    struct timespec *rem = (struct timespec *)trapFrame->x[1];
+    trapFrame->x[0] = do_nanosleep(req, rem);
+}
+
+/* the sleep isn't interrupted by the signal, rem is always 0 */
+int do_nanosleep(const struct timespec *req, struct timespec *rem){
+    if(req == NULL || req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000)
+        return -1;
+    unsigned long long frq;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+    sleep_ticks(req->tv_sec * frq + req->tv_nsec * frq / 1000000000);
+    if(rem != NULL){
+        rem->tv_sec = 0;
+        rem->tv_nsec = 0;
+    }
+    return 0;
+}
+
+void sys_sched_yield(TrapFrame *trapFrame){
+    schedule();
+    trapFrame->x[0] = 0;
+}
+
+void sys_waitpid(TrapFrame *trapFrame){
+    int pid = trapFrame->x[0];
+    int *status = (int *)trapFrame->x[1];
+    int options = trapFrame->x[2];
+    trapFrame->x[0] = do_waitpid(pid, status, options);
+}
+
+int do_waitpid(int pid, int *status, int options){
+    if(pid != -1 && !(pid >= 0 && pid < MAX_THREAD))
+        return -1;
+    return wait_child(pid, status, options & WNOHANG);
+}
+
+/* the address of the time data for clock_gettime of the user library */
+void sys_vdso_data(TrapFrame *trapFrame){
+    trapFrame->x[0] = (unsigned long)&vdso_data;
+}
+
+void sys_settimeofday(TrapFrame *trapFrame){
+    const struct timeval *tv = (const struct timeval *)trapFrame->x[0];
+    trapFrame->x[0] = do_settimeofday(tv);
+}
+
+int do_settimeofday(const struct timeval *tv){
+    if(tv == NULL || tv->tv_sec < 0 || tv->tv_usec < 0 || tv->tv_usec >= 1000000)
+        return -1;
+    vdso_settime(tv->tv_sec, tv->tv_usec * 1000);
+    return 0;
+}
+
+/* the ring of the calling thread, allocated on the first call */
+void sys_io_ring_setup(TrapFrame *trapFrame){
+    trapFrame->x[0] = (unsigned long)do_io_ring_setup();
+}
+
+/* run at most to_submit sqes, return the number taken from the sq */
+void sys_io_ring_enter(TrapFrame *trapFrame){
+    IoRing *ring = (IoRing *)trapFrame->x[0];
+    unsigned int to_submit = trapFrame->x[1];
+    trapFrame->x[0] = do_io_ring_enter(ring, to_submit);
+}
@@ -207,6 +207,40 @@ void fs_test7(){
     // assert(fd < 0);
 }
 
+void fs_test8(){
+    uart_puts("-----------------TEST VFS_PWRITE & SEEK_END & VFS_READ--------------\n");
+    File *file = NULL;
+    char buf[32];
+    int err = vfs_open("pwrite", O_CREAT, &file);
+    if(err){
+        uart_puts("[x] Failed to open \"pwrite\"\n");
+        return;
+    }
+    vfs_write(file, "Hello, World!", 13);
+
+    /* overwrite in the middle, the size stays 13 */
+    vfs_pwrite(file, "abc", 3, 5);
+    long size = vfs_lseek64(file, 0, SEEK_END);
+    vfs_lseek64(file, 0, SEEK_SET);
+    int sz = vfs_read(file, buf, sizeof(buf) - 1);
+    buf[sz < 0 ? 0 : sz] = '\0';
+    if(size != 13 || sz != 13 || strncmp(buf, "Helloabcorld!", 13) != 0)
+        uart_puts("[x] pwrite in the middle changed the size\n");
+    else
+        uart_puts("[v] pwrite in the middle: Helloabcorld!\n");
+
+    /* past the last block, the hole reads as zeros */
+    long far = MAX_DATA_LEN + 7;
+    vfs_pwrite(file, "xyz", 3, far);
+    size = vfs_lseek64(file, 0, SEEK_END);
+    sz = vfs_pread(file, buf, 4, far - 1);
+    if(size != far + 3 || sz != 4 || buf[0] != '\0' || strncmp(buf + 1, "xyz", 3) != 0)
+        uart_puts("[x] pwrite past the end\n");
+    else
+        uart_puts("[v] pwrite past the end\n");
+    vfs_close(file);
+}
+
 void user_basic2(){
     mkdir("/tmp", 0);
     int fd = open("/tmp/tmpfile", O_CREAT);
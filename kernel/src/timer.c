@@ -3,90 +3,385 @@
 #include <string.h>
 #include <malloc.h>
 #include <irq.h>
+#include <smp.h>
+#include <spinlock.h>
+#include <softirq.h>
 
 int printAfter2Second = 0;
-Timer *head = NULL;
-void add_timer(TimerTask task, unsigned long long expired_time, void *args, unsigned int tick){
-    unsigned long long system_timer = 0;
-    unsigned long long frq = 0;
 
-    asm volatile(
-        "mrs %0, cntpct_el0\n\t"
-        "mrs %1, cntfrq_el0\n\t" 
-        :"=r"(system_timer), "=r"(frq)
-    );
+static TimerBase timer_bases[NR_CPUS];
 
-    Timer *timer = (Timer*)kmalloc(sizeof(Timer));
-    memset((char *)timer, 0, sizeof(Timer));
-    if(tick)
-        timer->expired_time = system_timer + expired_time;
-    else
-        timer->expired_time = system_timer + expired_time * frq;
+static inline unsigned long long read_cntpct(){
+    unsigned long long cnt;
+    asm volatile("isb\n\tmrs %0, cntpct_el0\n\t" :"=r"(cnt) ::"memory");
+    return cnt;
+}
+
+static inline unsigned long long wheel_clk(){
+    return read_cntpct() >> WHEEL_SHIFT;
+}
+
+void timers_init(){
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        TimerBase *base = &timer_bases[i];
+        spin_lock_init(&base->lock, "timer_lock");
+        base->clk = wheel_clk();
+        base->next_expiry = base->clk + NEXT_TIMER_MAX_DELTA;
+        base->next_expiry_recalc = 0;
+        base->timers_pending = 0;
+        INIT_LIST_HEAD(&base->expired);
+        INIT_LIST_HEAD(&base->hrtimers);
+        base->programmed = ~0ULL;
+        base->nr_irq = 0;
+        base->nr_expired = 0;
+        base->nr_hr_expired = 0;
+        base->nr_slack = 0;
+        base->nr_saved = 0;
+        base->nr_program = 0;
+        base->nr_defer = 0;
+        base->max_run = 0;
+        for(unsigned int lvl = 0; lvl < LVL_DEPTH; lvl++)
+            base->pending_map[lvl] = 0;
+        for(unsigned int idx = 0; idx < WHEEL_SIZE; idx++)
+            INIT_LIST_HEAD(&base->vectors[idx]);
+    }
+}
+
+void init_timer(Timer *timer, TimerTask task, void *args){
+    INIT_LIST_HEAD(&timer->entry);
     timer->task = task;
     timer->args = args;
-    timer->next = NULL;
-    timer->prev = NULL;
+    timer->expired_time = 0;
+    timer->idx = 0;
+    timer->cpu = -1;
+    timer->flags = 0;
+}
 
-    if(head == NULL){
-        head = timer;
-        reset_timer_irq(head->expired_time);
-        return;
+/* the bucket of expires on level lvl, and the wheel clock the bucket expires at */
+static unsigned int calc_index(unsigned long long expires, unsigned int lvl, unsigned long long *bucket_expiry){
+    expires = (expires >> LVL_SHIFT(lvl)) + 1;
+    *bucket_expiry = expires << LVL_SHIFT(lvl);
+    return LVL_OFFS(lvl) + (expires & LVL_MASK);
+}
+
+static unsigned int calc_wheel_index(unsigned long long expires, unsigned long long clk, unsigned long long *bucket_expiry){
+    unsigned long long delta = expires - clk;
+
+    /* already expired, run it at the current wheel clock */
+    if((long long)delta < 0){
+        *bucket_expiry = clk;
+        return clk & LVL_MASK;
     }
-    Timer *tmp = head;
-    while(tmp->next != NULL && timer->expired_time > tmp->expired_time){
-        tmp = tmp->next;
+    for(unsigned int lvl = 0; lvl < LVL_DEPTH - 1; lvl++){
+        if(delta < LVL_START(lvl + 1))
+            return calc_index(expires, lvl, bucket_expiry);
     }
+    if(delta >= WHEEL_TIMEOUT_CUTOFF)
+        expires = clk + WHEEL_TIMEOUT_MAX;
+    return calc_index(expires, LVL_DEPTH - 1, bucket_expiry);
+}
+
+/* the distance from bucket clk to the next pending bucket of the level, -1: none */
+static int next_pending_bucket(TimerBase *base, unsigned int lvl, unsigned int clk){
+    unsigned long long map = base->pending_map[lvl];
+    if(map == 0) return -1;
+    if(clk) map = (map >> clk) | (map << (LVL_SIZE - clk));
+    return __builtin_ctzll(map);
+}
+
+/* search the pending buckets of every level, the caller holds base->lock */
+static unsigned long long next_timer_expiry(TimerBase *base){
+    unsigned long long clk = base->clk;
+    unsigned long long next = base->clk + NEXT_TIMER_MAX_DELTA;
 
-    if(timer->expired_time <= tmp->expired_time){
-        if(tmp == head){
-            head = timer;
-            head->next = tmp;
-            tmp->prev = head;
-            reset_timer_irq(head->expired_time);
+    for(unsigned int lvl = 0; lvl < LVL_DEPTH; lvl++){
+        int pos = next_pending_bucket(base, lvl, clk & LVL_MASK);
+        unsigned long long lvl_clk = clk & LVL_CLK_MASK;
+        if(pos >= 0){
+            unsigned long long tmp = (clk + pos) << LVL_SHIFT(lvl);
+            if(tmp < next) next = tmp;
+            /* it expires before the next level turns, the upper levels can't be earlier */
+            if((unsigned int)pos <= ((LVL_CLK_DIV - lvl_clk) & LVL_CLK_MASK))
+                break;
         }
-        else{
-            timer->next = tmp;
-            timer->prev = tmp->prev;
-            tmp->prev->next = timer;
-            tmp->prev = timer;
+        /* the clock of the next level, rounded up */
+        clk = (clk >> LVL_CLK_SHIFT) + (lvl_clk ? 1 : 0);
+    }
+    base->next_expiry_recalc = 0;
+    return next;
+}
+
+/* write cntp_cval_el0 of this cpu, ~0: no timer */
+static void timer_program_event(TimerBase *base, unsigned long long event){
+    base->programmed = event;
+    base->nr_program++;
+    if(event == ~0ULL)
+        set_long_timer_irq();
+    else
+        reset_timer_irq(event);
+}
+
+/* the first event of this cpu, the earlier of the first wheel bucket and the first hrtimer expires */
+static unsigned long long timer_next_event(TimerBase *base){
+    unsigned long long next = ~0ULL;
+    for(unsigned int lvl = 0; lvl < LVL_DEPTH; lvl++){
+        if(base->pending_map[lvl]){
+            next = base->next_expiry << WHEEL_SHIFT;
+            break;
         }
     }
-    else{
-        tmp->next = timer;
-        timer->prev = tmp;
+    if(!list_empty(&base->hrtimers)){
+        Hrtimer *first = (Hrtimer *)base->hrtimers.next;
+        if(first->expires < next) next = first->expires;
     }
+    return next;
+}
+
+/* a new timer reprograms the irq only if it is earlier than the programmed one */
+static void timer_event_add(TimerBase *base, unsigned long long event){
+    if(event < base->programmed)
+        timer_program_event(base, event);
+}
 
+/*
+ * The wheel clock only moves in timer_softirq, the timers are put in buckets by the distance to it.
+ * After an idle period, move it to now, or to the first pending bucket if that is earlier.
+ */
+static void forward_timer_base(TimerBase *base, unsigned long long now){
+    if(now <= base->clk) return;
+    if(base->next_expiry > now)
+        base->clk = now;
+    else
+        base->clk = base->next_expiry;
 }
 
+static void enqueue_timer(TimerBase *base, Timer *timer){
+    unsigned long long bucket_expiry;
+    unsigned int idx = calc_wheel_index(timer->expired_time >> WHEEL_SHIFT, base->clk, &bucket_expiry);
 
-void timer_interrupt_handler(){
-    while(head != NULL){
-        if(head->next != NULL){
-            Timer *tmp = head;
-            head = head->next;
-            head->prev = NULL;
-            tmp->task(tmp->args);
-            kfree(tmp);
-            tmp = NULL;
-            unsigned long long system_timer = 0;
-            asm volatile("mrs %0, cntpct_el0\n\t" :"=r"(system_timer));
-            if(head->expired_time > system_timer){
-                reset_timer_irq(head->expired_time);
-                break;
-            }
-        } 
-        else{
-            Timer *tmp = head;
-            head = NULL;
-            tmp->task(tmp->args);
-            kfree(tmp);
-            tmp = NULL;
-            break;
+    list_add_tail(&timer->entry, &base->vectors[idx]);
+    base->pending_map[idx / LVL_SIZE] |= 1ULL << (idx % LVL_SIZE);
+    timer->idx = idx;
+    timer->cpu = base - timer_bases;
+    base->timers_pending++;
+    if(bucket_expiry < base->next_expiry)
+        base->next_expiry = bucket_expiry;
+    timer_event_add(base, bucket_expiry << WHEEL_SHIFT);
+}
+
+static void detach_timer(TimerBase *base, Timer *timer){
+    list_del(&timer->entry);
+    INIT_LIST_HEAD(&timer->entry);
+    if(list_empty(&base->vectors[timer->idx]))
+        base->pending_map[timer->idx / LVL_SIZE] &= ~(1ULL << (timer->idx % LVL_SIZE));
+    timer->cpu = -1;
+    base->timers_pending--;
+}
+
+/*
+ * Deactivate a pending timer, return 1 if it was pending.
+ * It doesn't wait for a task already running on another cpu.
+ */
+int del_timer(Timer *timer){
+    TimerBase *base;
+    unsigned long flags;
+    while(1){
+        int cpu = timer->cpu;
+        if(cpu < 0) return 0;
+        base = &timer_bases[cpu];
+        flags = spin_lock_irqsave(&base->lock);
+        /* it may expire before we get the lock */
+        if(timer->cpu == cpu) break;
+        spin_unlock_irqrestore(&base->lock, flags);
+    }
+    detach_timer(base, timer);
+    /* cntp_cval_el0 is left as it is, an early irq just finds nothing to run */
+    base->next_expiry_recalc = 1;
+    spin_unlock_irqrestore(&base->lock, flags);
+    return 1;
+}
+
+/*
+ * (Re)arm the timer on this cpu to expire at cntpct expires, return 1 if it was pending.
+ * mod_timer and del_timer of the same timer are serialized by the caller.
+ */
+int mod_timer(Timer *timer, unsigned long long expires){
+    int ret = del_timer(timer);
+
+    /* every cpu has its own wheel, mask the irq first so we stay on this cpu */
+    unsigned long flags = local_irq_save();
+    TimerBase *base = &timer_bases[get_cpu()->id];
+    spin_lock(&base->lock);
+    if(base->next_expiry_recalc)
+        base->next_expiry = next_timer_expiry(base);
+    forward_timer_base(base, wheel_clk());
+    timer->expired_time = expires;
+    enqueue_timer(base, timer);
+    spin_unlock_irqrestore(&base->lock, flags);
+    return ret;
+}
+
+void hrtimer_init(Hrtimer *timer, TimerTask task, void *args){
+    INIT_LIST_HEAD(&timer->entry);
+    timer->task = task;
+    timer->args = args;
+    timer->soft_expires = 0;
+    timer->expires = 0;
+    timer->cpu = -1;
+}
+
+/* deactivate a pending hrtimer, return 1 if it was pending */
+int hrtimer_cancel(Hrtimer *timer){
+    TimerBase *base;
+    unsigned long flags;
+    while(1){
+        int cpu = timer->cpu;
+        if(cpu < 0) return 0;
+        base = &timer_bases[cpu];
+        flags = spin_lock_irqsave(&base->lock);
+        if(timer->cpu == cpu) break;
+        spin_unlock_irqrestore(&base->lock, flags);
+    }
+    list_del(&timer->entry);
+    INIT_LIST_HEAD(&timer->entry);
+    timer->cpu = -1;
+    spin_unlock_irqrestore(&base->lock, flags);
+    return 1;
+}
+
+/* 
+ * (Re)arm the hrtimer on this cpu to run in [expires, expires + slack] of cntpct.
+ * The hrtimers are few, they are kept in a list sorted by expires.
+ */
+void hrtimer_start(Hrtimer *timer, unsigned long long expires, unsigned long long slack){
+    hrtimer_cancel(timer);
+
+    unsigned long flags = local_irq_save();
+    TimerBase *base = &timer_bases[get_cpu()->id];
+    spin_lock(&base->lock);
+    timer->soft_expires = expires;
+    timer->expires = expires + slack;
+    /* search from the tail, a new timer is usually the latest */
+    struct list_head *pos = base->hrtimers.prev;
+    while(pos != &base->hrtimers && ((Hrtimer *)pos)->expires > timer->expires)
+        pos = pos->prev;
+    list_add(&timer->entry, pos);
+    timer->cpu = base - timer_bases;
+    timer_event_add(base, timer->expires);
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+/* a one-shot timer freed after it runs, expired_time is in seconds, or in cntpct ticks if tick is set */
+void add_timer(TimerTask task, unsigned long long expired_time, void *args, unsigned int tick){
+    unsigned long long frq = 0;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+
+    Timer *timer = (Timer*)kmalloc(sizeof(Timer));
+    init_timer(timer, task, args);
+    timer->flags = TIMER_KMALLOC;
+    if(tick)
+        mod_timer(timer, read_cntpct() + expired_time);
+    else
+        mod_timer(timer, read_cntpct() + expired_time * frq);
+}
+
+/*
+ * Move the buckets expiring at base->clk to base->expired.
+ * A level is only checked when the clock of the lower level wraps.
+ */
+static void collect_expired_timers(TimerBase *base){
+    unsigned long long clk = base->clk;
+
+    for(unsigned int lvl = 0; lvl < LVL_DEPTH; lvl++){
+        unsigned long long bit = 1ULL << (clk & LVL_MASK);
+        if(base->pending_map[lvl] & bit){
+            base->pending_map[lvl] &= ~bit;
+            list_splice_tail_init(&base->vectors[LVL_OFFS(lvl) + (clk & LVL_MASK)], &base->expired);
         }
+        if(clk & LVL_CLK_MASK)
+            break;
+        clk >>= LVL_CLK_SHIFT;
     }
-    if(head == NULL){
-        set_long_timer_irq();
-    } 
+}
+
+/*
+ * TIMER_SOFTIRQ: run the expired timers of this cpu with the irq enabled.
+ * At most TIMER_MAX_RUN callbacks in one run, the irq is only masked in the short lock sections.
+ * The rest stays in base->expired and TIMER_SOFTIRQ is raised again,
+ * do_softirq runs it in the next round or passes it to the kworker.
+ */
+void timer_softirq(){
+    TimerBase *base = &timer_bases[get_cpu()->id];
+    unsigned long long now = wheel_clk();
+    unsigned int ran = 0;
+    unsigned long flags = spin_lock_irqsave(&base->lock);
+
+    /* the top half pushed cntp_cval_el0 away */
+    base->programmed = ~0ULL;
+    base->nr_irq++;
+    if(base->next_expiry_recalc)
+        base->next_expiry = next_timer_expiry(base);
+    while(now >= base->clk && now >= base->next_expiry){
+        /* nothing is pending before next_expiry, skip the empty buckets */
+        if(base->next_expiry > base->clk)
+            base->clk = base->next_expiry;
+        collect_expired_timers(base);
+        base->clk++;
+        base->next_expiry = next_timer_expiry(base);
+    }
+
+    while(!list_empty(&base->expired) && ran < TIMER_MAX_RUN){
+        Timer *timer = (Timer *)base->expired.next;
+        TimerTask task = timer->task;
+        void *args = timer->args;
+        unsigned int kmalloced = timer->flags & TIMER_KMALLOC;
+        /* the bucket bit is cleared already */
+        list_del(&timer->entry);
+        INIT_LIST_HEAD(&timer->entry);
+        timer->cpu = -1;
+        base->timers_pending--;
+        base->nr_expired++;
+        ran++;
+        /* the task may arm a timer, run it without the lock */
+        spin_unlock_irqrestore(&base->lock, flags);
+        task(args);
+        if(kmalloced)
+            kfree(timer);
+        flags = spin_lock_irqsave(&base->lock);
+    }
+
+    /* the hrtimers in their slack window share this irq */
+    while(!list_empty(&base->hrtimers) && ran < TIMER_MAX_RUN){
+        Hrtimer *timer = (Hrtimer *)base->hrtimers.next;
+        unsigned long long now_tick = read_cntpct();
+        if(timer->soft_expires > now_tick)
+            break;
+        if(timer->expires > now_tick)
+            base->nr_slack++;
+        TimerTask task = timer->task;
+        void *args = timer->args;
+        list_del(&timer->entry);
+        INIT_LIST_HEAD(&timer->entry);
+        timer->cpu = -1;
+        base->nr_hr_expired++;
+        ran++;
+        spin_unlock_irqrestore(&base->lock, flags);
+        task(args);
+        flags = spin_lock_irqsave(&base->lock);
+    }
+    /* every timer would have its own irq without the wheel buckets and the slack */
+    if(ran > 1)
+        base->nr_saved += ran - 1;
+    if(ran > base->max_run)
+        base->max_run = ran;
+
+    forward_timer_base(base, now);
+    if(ran == TIMER_MAX_RUN){
+        base->nr_defer++;
+        raise_softirq(TIMER_SOFTIRQ);
+    }
+    timer_program_event(base, timer_next_event(base));
+    spin_unlock_irqrestore(&base->lock, flags);
     if(printAfter2Second == 0) {
         add_timer(timeout_print, 2, "[*] After Two Second, Hello User\n", 0);
         printAfter2Second = 1;
@@ -94,23 +389,91 @@ void timer_interrupt_handler(){
     enable_timer_irq();
 }
 
-void timer_interrupt_handler_el0(){
-    head = NULL;
-    uart_puts("Time interrupt\n");
-    // set_period_timer_irq();
-    add_timer(timeout_print, 1, "[*] Time irq\n", 0);
-    enable_timer_irq();
+static void timer_bench_task(void *args){
+    (void)args;
+}
+
+/*
+ * Arm num timers 1~11 seconds away on this cpu, then delete them all.
+ * Print the cost of mod_timer and del_timer.
+ */
+void timer_bench(unsigned int num){
+    unsigned long long frq, start, armed, deleted;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+    if(num == 0) return;
+
+    Timer *timers = (Timer *)kmalloc(sizeof(Timer) * num);
+    if(timers == NULL){
+        uart_puts("[x] timer bench: out of memory\n");
+        return;
+    }
+    for(unsigned int i = 0; i < num; i++)
+        init_timer(&timers[i], timer_bench_task, NULL);
+
+    /* stay on this cpu, all the timers are on one wheel */
+    preempt_disable();
+    start = read_cntpct();
+    for(unsigned int i = 0; i < num; i++)
+        mod_timer(&timers[i], start + frq + (i * 7919ULL % 10000) * (frq / 1000));
+    armed = read_cntpct();
+    for(unsigned int i = 0; i < num; i++)
+        del_timer(&timers[i]);
+    deleted = read_cntpct();
+    preempt_enable();
+    kfree(timers);
+
+    print_string(UITOA, "[*] timer bench: timers: ", num, 1);
+    print_string(UITOA, "    mod_timer total(us): ", (armed - start) * 1000000 / frq, 0);
+    print_string(UITOA, " | avg(ns): ", (armed - start) * 1000000000 / frq / num, 1);
+    print_string(UITOA, "    del_timer total(us): ", (deleted - armed) * 1000000 / frq, 0);
+    print_string(UITOA, " | avg(ns): ", (deleted - armed) * 1000000000 / frq / num, 1);
 }
 
 void timeout_print(void *args){
     uart_puts((char*)args);
 }
 
+void print_timer_stat(){
+    uart_puts("-------------------------- Timer Stat --------------------------\n");
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        TimerBase *base = &timer_bases[i];
+        print_string(UITOA, "[cpu ", i, 0);
+        print_string(UITOA, "] irqs: ", base->nr_irq, 0);
+        print_string(UITOA, " | wheel run: ", base->nr_expired, 0);
+        print_string(UITOA, " | hrtimer run: ", base->nr_hr_expired, 0);
+        print_string(UITOA, " | slack run: ", base->nr_slack, 0);
+        print_string(UITOA, " | irqs saved: ", base->nr_saved, 0);
+        print_string(UITOA, " | cval writes: ", base->nr_program, 0);
+        print_string(UITOA, " | max run: ", base->max_run, 0);
+        print_string(UITOA, " | deferred: ", base->nr_defer, 0);
+        print_string(UITOA, " | wheel pending: ", base->timers_pending, 1);
+    }
+}
+
+static Hrtimer tick_timers[NR_CPUS];
+
+/* 
+ * The scheduler tick of this cpu, a precise hrtimer with no slack.
+ * Called with NULL once on every cpu to start it, then it rearms itself one period after the last expiry.
+ */
 void sched_timeout(void *args){
-    // uart_puts("omg\n");
     unsigned long long frq;
     asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
-    add_timer(sched_timeout, frq>>5 , "omg", 1);
+    unsigned long long period = frq >> SCHED_TICK_SHIFT;
+    unsigned long long now = read_cntpct();
+    Hrtimer *tick = &tick_timers[get_cpu()->id];
+    unsigned long long expires;
+
+    if(args == NULL){
+        hrtimer_init(tick, sched_timeout, tick);
+        expires = now + period;
+    }
+    else{
+        /* keep the phase, skip the periods missed */
+        expires = tick->soft_expires + period;
+        while(expires <= now) expires += period;
+    }
+    hrtimer_start(tick, expires, 0);
 }
 
 void enable_el0_get_timer(){
@@ -118,4 +481,4 @@ void enable_el0_get_timer(){
     asm volatile("mrs %0, cntkctl_el1" : "=r"(tmp));
     tmp |= 1;
     asm volatile("msr cntkctl_el1, %0" : : "r"(tmp));
-}
\ No newline at end of file
+}
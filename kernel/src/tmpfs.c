@@ -2,14 +2,13 @@
 #include <malloc.h>
 #include <string.h>
 #include <uart.h>
+#include <printk.h>
 #include <string.h>
+#include <sched.h>
 
 struct file_operations* tmpfs_file_ops;
 struct vnode_operations* tmpfs_vnode_ops;
 
-extern char *global_dir;
-extern Dentry *global_dentry;
-
 int tmpfs_setup_mount(FileSystem *fs, Mount *mount){
     mount->fs = fs;
     mount->root_dentry = tmpfs_create_dentry("/", NULL, D_DIR, mount); 
@@ -52,82 +51,84 @@ void tmpfs_set_ops(){
     tmpfs_file_ops->open = tmpfs_open;
     tmpfs_file_ops->close = tmpfs_close;
     tmpfs_file_ops->lseek64 = tmpfs_lseek64;
+    tmpfs_file_ops->pread = tmpfs_pread;
+    tmpfs_file_ops->pwrite = tmpfs_pwrite;
 
     tmpfs_vnode_ops->lookup = tmpfs_lookup;
     tmpfs_vnode_ops->create = tmpfs_create;
     tmpfs_vnode_ops->mkdir = tmpfs_mkdir;
 }
 
-int tmpfs_write(struct file* file, const void* buf, size_t len){
-    uart_puts("[*] tmpfs_write | ");
-    print_string(UITOA, "len : ", len, 1);
+/*
+ * Write at *f_pos and move it, the file position of write or the local one of pwrite.
+ * Block idx covers [(idx - 1) * MAX_DATA_LEN, idx * MAX_DATA_LEN), every block before the last one is full.
+ * The bytes after the write are kept, the hole of a write past the end reads as zeros.
+ */
+static int tmpfs_write_at(struct file* file, const void* buf, size_t len, size_t *f_pos){
     TmpfsInode *inode_head = (TmpfsInode *)file->vnode->internal;
-    char *src = (char *)buf;
-    size_t write_len = len;
+    const char *src = (const char *)buf;
+    size_t write_pos = *f_pos;
+    size_t end = write_pos + len;
     size_t write_idx = 0;
-    /* if offset != 0, it may not work */
-    inode_head->size = 0;
+    if(len == 0) return 0;
+
+    /* add the blocks up to the one of the last byte */
+    TmpfsInode *last = (TmpfsInode *)inode_head->list.prev;
+    while(last->idx * MAX_DATA_LEN < end){
+        TmpfsInode *new_block = (TmpfsInode *)kmalloc(sizeof(TmpfsInode));
+        INIT_LIST_HEAD(&new_block->list);
+        new_block->idx = last->idx + 1;
+        new_block->size = 0;
+        new_block->vnode = inode_head->vnode;
+        list_add_tail(&new_block->list, &inode_head->list);
+        printk(LOGLEVEL_DEBUG, "[*] Tmpfs Write: Create new block\n");
+        last = new_block;
+    }
+    unsigned long end_idx = (end - 1) / MAX_DATA_LEN + 1;
 
     struct list_head *pos;
     list_for_each(pos, &inode_head->list){
         TmpfsInode *block = (TmpfsInode *)pos;
-        if(file->f_pos >= block->idx * MAX_DATA_LEN){
-            inode_head->size += MAX_DATA_LEN;
-            continue;
+        if(block->idx > end_idx) break;
+        /* the blocks before the last one are full, the zeros fill the hole */
+        if(block->idx < end_idx && block->size < MAX_DATA_LEN){
+            memset(block->data + block->size, 0, MAX_DATA_LEN - block->size);
+            block->size = MAX_DATA_LEN;
         }
 
-        while(1){
-            /* f_pos is in the block of some offset */
-            size_t offset = MAX_DATA_LEN - (block->idx * MAX_DATA_LEN - file->f_pos);
-            size_t quota = MAX_DATA_LEN - offset;
-
-            if(write_len <= quota){
-                memcpy(block->data + offset, src + write_idx, write_len);
-                file->f_pos += write_len;
-                write_idx += write_len;
-                block->size = offset + write_len;
-
-                /* if offset != 0, it may not work */
-                inode_head->size += write_len;
-                print_string(UITOA, "[*] File size: ", inode_head->size, 1);
-                goto DONE;
-            }
-            else if(write_len > quota){
-                memcpy(block->data + offset, src + write_idx, quota);
-                file->f_pos += quota;
-                write_idx += quota;
-                write_len -= quota;
-                block->size = MAX_DATA_LEN;
-
-                /* if offset != 0, it may not work */
-                inode_head->size += quota;
-
-                /* add a new block */
-                TmpfsInode *new_block = (TmpfsInode *)kmalloc(sizeof(TmpfsInode));
-                INIT_LIST_HEAD(&new_block->list);
-                // new_block->data = (char *)kmalloc(sizeof(char) * MAX_DATA_LEN);
-                new_block->idx = block->idx + 1;
-                new_block->size = 0;
-                new_block->vnode = inode_head->vnode;
-                list_add_tail(&new_block->list, &inode_head->list);
-
-                // uart_puts(block->vnode->dentry->name);
-                // uart_puts("\n");
-
-                uart_puts("[*] Tmpfs Write: Create new block\n");
-                /* next round will write the data into the new block */
-                block = new_block;
-            }
-        }
+        size_t block_start = (block->idx - 1) * MAX_DATA_LEN;
+        if(block->idx * MAX_DATA_LEN <= write_pos) continue;
+        size_t offset = write_pos - block_start;
+        size_t quota = MAX_DATA_LEN - offset;
+        size_t n = end - write_pos < quota ? end - write_pos : quota;
+
+        if(block->size < offset)
+            memset(block->data + block->size, 0, offset - block->size);
+        memcpy(block->data + offset, src + write_idx, n);
+        if(block->size < offset + n) block->size = offset + n;
+        write_pos += n;
+        write_idx += n;
     }
 
-DONE:
+    if(inode_head->size < end) inode_head->size = end;
+    *f_pos = end;
+    printk(LOGLEVEL_DEBUG, "[*] File size: %lu\n", inode_head->size);
     return write_idx;
 }
 
-int tmpfs_read(struct file* file, void* buf, size_t len){
-    uart_puts("[*] tmpfs_read | ");
-    print_string(UITOA, "len : ", len, 1);
+int tmpfs_write(struct file* file, const void* buf, size_t len){
+    printk(LOGLEVEL_DEBUG, "[*] tmpfs_write | len : %lu\n", len);
+    return tmpfs_write_at(file, buf, len, &file->f_pos);
+}
+
+int tmpfs_pwrite(struct file* file, const void* buf, size_t len, long pos){
+    printk(LOGLEVEL_DEBUG, "[*] tmpfs_pwrite | len : %lu | pos : %ld\n", len, pos);
+    size_t f_pos = pos;
+    return tmpfs_write_at(file, buf, len, &f_pos);
+}
+
+/* read at *f_pos and move it, like tmpfs_write_at */
+static int tmpfs_read_at(struct file* file, void* buf, size_t len, size_t *f_pos){
     TmpfsInode *inode_head = (TmpfsInode *)file->vnode->internal;
     char *dest = (char *)buf;
     size_t read_len = len;
@@ -138,29 +139,29 @@ int tmpfs_read(struct file* file, void* buf, size_t len){
     list_for_each(pos, &inode_head->list){
         TmpfsInode *block = (TmpfsInode *)pos;
         /* first need to iterate to the right block beacuse of the f_pos */
-        if(file->f_pos >= block->idx * MAX_DATA_LEN){
+        if(*f_pos >= block->idx * MAX_DATA_LEN){
             continue;
         }
         /* f_pos is in the block of the offset */
-        size_t offset = MAX_DATA_LEN - (block->idx * MAX_DATA_LEN - file->f_pos);
+        size_t offset = MAX_DATA_LEN - (block->idx * MAX_DATA_LEN - *f_pos);
         // print_string(UITOA, "offset: ", offset, 1);
         // if(block->data[offset] == (char)EOF) return -1; // no need EOF?
 
         /* if the offset is the end, it means end of the file */
-        if(block->size <= offset) return 0;
+        if(block->size <= offset) goto DONE;
         size_t quota = block->size - offset;
 
         if(read_len <= quota){
             /* len < quota, read len is ok */
             memcpy(dest + read_idx, block->data + offset, read_len);
             read_idx += read_len;
-            file->f_pos += read_len;
+            *f_pos += read_len;
             goto DONE;
         }
         else if(read_len > quota){
             /* len >= quota, read quota*/
             memcpy(dest + read_idx, block->data + offset, quota);
-            file->f_pos += quota;
+            *f_pos += quota;
             read_idx += quota;
             read_len -= quota;
         }
@@ -169,6 +170,18 @@ int tmpfs_read(struct file* file, void* buf, size_t len){
 DONE:
     return read_idx;
 }
+
+int tmpfs_read(struct file* file, void* buf, size_t len){
+    printk(LOGLEVEL_DEBUG, "[*] tmpfs_read | len : %lu\n", len);
+    return tmpfs_read_at(file, buf, len, &file->f_pos);
+}
+
+int tmpfs_pread(struct file* file, void* buf, size_t len, long pos){
+    printk(LOGLEVEL_DEBUG, "[*] tmpfs_pread | len : %lu | pos : %ld\n", len, pos);
+    size_t f_pos = pos;
+    return tmpfs_read_at(file, buf, len, &f_pos);
+}
+
 int tmpfs_open(struct vnode* file_node, struct file** target){
     if(file_node == NULL){
         return -1;
@@ -182,30 +195,33 @@ int tmpfs_open(struct vnode* file_node, struct file** target){
     return 0;
 }
 int tmpfs_close(struct file* file){
-    uart_puts("[*] Closed file: ");
-    uart_puts(file->vnode->dentry->name);
-    uart_puts("\n");
+    printk(LOGLEVEL_DEBUG, "[*] Closed file: %s\n", file->vnode->dentry->name);
 
     kfree(file);
     file = NULL;
     return 0;
 }
+/* return the new offset, the offset before the start is -1 */
 long tmpfs_lseek64(struct file* file, long offset, int whence){
+    long base;
     switch(whence){
         case SEEK_SET:
-            if(offset < 0) return -1;
-            file->f_pos = offset;
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = file->f_pos;
+            break;
+        case SEEK_END:
+            /* the device node has no data */
+            if(file->vnode->internal == NULL) return -1;
+            base = ((TmpfsInode *)file->vnode->internal)->size;
             break;
-        // case SEEK_CUR:
-        //     file->f_pos += offset;
-        //     break;
-        // case SEEK_END:
-        //     file->f_pos = file->vnode->internal->size + offset;
-        //     break;
         default:
             return -1;
     }
-    return 0;
+    if(base + offset < 0) return -1;
+    file->f_pos = base + offset;
+    return file->f_pos;
 }
 
 
@@ -2,23 +2,85 @@
 #include <gpio.h>
 #include <irq.h>
 #include <string.h>
+#include <spinlock.h>
+#include <softirq.h>
+#include <pl011.h>
+#include <sched.h>
 
 char read_buf[MAX_SIZE];
-char write_buf[MAX_SIZE];
+char write_buf[UART_TX_BUF_SIZE];
 static unsigned int read_set_idx = 0;
 static unsigned int read_get_idx = 0;
 static unsigned int write_set_idx = 0;
 static unsigned int write_get_idx = 0;
+/* protect the read/write buffer, the uart irq is handled by core 0 but any core can read/write */
+Spinlock uart_lock;
+/* the irq counts are changed in the irq of core 0, the byte counts under uart_lock */
+static UartStat uart_stat;
+/* the writer sleeping until write_buf is half empty, under uart_lock */
+static Thread *tx_waiter;
+/* the bootloader leaves the mini uart set up, it prints until uart_init */
+const UartOps *uart_ops = &mini_uart_ops;
 
+static void mini_uart_init();
+static void uart_start_tx();
 
 void uart_init(){
+  spin_lock_init(&uart_lock, "uart_lock");
+#if UART_BACKEND == UART_PL011
+  uart_ops = &pl011_ops;
+  pl011_init(PL011_BAUD);
+#else
+  uart_ops = &mini_uart_ops;
+  mini_uart_init();
+#endif
+}
+
+static unsigned int mini_uart_rx_level(){
+  return AUX_MU_STAT_RX_LEVEL(*AUX_MU_STAT);
+}
+
+static unsigned int mini_uart_tx_room(){
+  return AUX_MU_FIFO_SIZE - AUX_MU_STAT_TX_LEVEL(*AUX_MU_STAT);
+}
+
+static char mini_uart_read(){
+  return (char)(*AUX_MU_IO);
+}
+
+static void mini_uart_write(unsigned int c){
+  *AUX_MU_IO = c;
+}
+
+static void mini_uart_rx_irq(int on){
+  if(on) enable_AUX_MU_IER_r();
+  else disable_AUX_MU_IER_r();
+}
+
+static void mini_uart_tx_irq(int on){
+  if(on) enable_AUX_MU_IER_w();
+  else disable_AUX_MU_IER_w();
+}
+
+const UartOps mini_uart_ops = {
+  .name = "mini uart",
+  .fifo_size = AUX_MU_FIFO_SIZE,
+  .rx_level = mini_uart_rx_level,
+  .tx_room = mini_uart_tx_room,
+  .read = mini_uart_read,
+  .write = mini_uart_write,
+  .rx_irq = mini_uart_rx_irq,
+  .tx_irq = mini_uart_tx_irq,
+};
+
+static void mini_uart_init(){
   *AUX_ENABLE     |= 1;   // Enable mini UART.
   *AUX_MU_CNTL    = 0;    // Disable transmitter and receiver during configuration.
   *AUX_MU_IER     = 0;    // Disable interrupt because currently you don’t need interrupt.
   *AUX_MU_LCR     = 3;    // Set the data size to 8 bit.
   *AUX_MU_MCR     = 0;    // Don’t need auto flow control.
   *AUX_MU_BAUD    = 270;  // Set baud rate and characteristics (115200 8N1) and map to GPIO 
-  *AUX_MU_IIR     = 6;    // No FIFO
+  *AUX_MU_IIR     = 6;    // Clear the rx/tx FIFOs, they are always enabled
 
   /* map UART1 to GPIO pins */
   register unsigned int reg;
@@ -37,7 +99,7 @@ void uart_init(){
   *GPPUDCLK0 = 0;                 // flush GPIO setup
   *AUX_MU_CNTL = 3;               // enable Tx, Rx
 
-  *ENABLE_IRQS_1 = 1 << 29;       // enable UART1 IRQ
+  request_irq(IRQ_AUX, uart_irq_handler, "uart1", NULL);  // enable UART1 IRQ
 
 }
 
@@ -52,85 +114,220 @@ char uart_getc(){
   read. To do a non-destructive read of this overrun bit
   use the Mini Uart Extra Status register. 
   */
-  while(!(*AUX_MU_LSR & 0x01)) {asm volatile("nop");}
+  while(uart_ops->rx_level() == 0) {asm volatile("nop");}
   /* read it and return */
-  char r = (char)(*AUX_MU_IO);
+  char r = uart_ops->read();
   /* convert carrige return to newline */
   return r == '\r'?'\n':r;
 }
 
+/* 
+    AUX_MU_IIR:
+    On read this register shows the interrupt ID bit Interrupt ID
+    bit[2:1]
+    00 : No interrupts
+    01 : Transmit holding register empty
+    10 : Receiver holds valid byte
+    11 : <Not possible>
+
+    AUX_MU_IER_REG:
+    bit 1: Enable Transmit interrupt
+    bit 0: Enable Receive interrupt
+*/
+/* IRQ_AUX */
+void uart_irq_handler(unsigned int irq, void *dev_id){
+  unsigned int iir = *AUX_MU_IIR;
+  /* LSR bit 1: rx overrun, cleared by the read */
+  if(*AUX_MU_LSR & 0x02) uart_rx_overrun();
+  if(iir & TRANSMIT_HOLDING) // Transmit interrupt
+    tran_interrupt_handler();
+  else if(iir & RECEIVE_VALID) // Receive interrupt
+    recv_interrupt_handler();
+}
+
+/* the top half: mask the receive interrupt until the softirq drains the rx fifo */
 void recv_interrupt_handler(){
-  /* read buffer is full, discard the new char */
-  if((read_set_idx + 1) % MAX_SIZE == read_get_idx){
-    disable_AUX_MU_IER_r();
-    return;
-  } 
-
-  read_buf[read_set_idx] = uart_getc();
-  read_set_idx = (read_set_idx + 1) % MAX_SIZE; /* reset the index if it reaches the end */
+  uart_stat.rx_irq++;
+  uart_ops->rx_irq(0);
+  raise_softirq(UART_RX_SOFTIRQ);
+}
+
+/* 
+ * UART_RX_SOFTIRQ: move the rx fifo to read_buf.
+ * Read as many bytes as the rx fifo level says are in it, without polling the status for each one.
+ */
+void uart_rx_softirq(){
+  unsigned int batch = 0;
+  unsigned long flags = spin_lock_irqsave(&uart_lock);
+  unsigned int level;
+  while((level = uart_ops->rx_level()) != 0){
+    while(level--){
+      /* read buffer is full, leave the rest in the fifo, async_uart_getc enables the interrupt again */
+      if((read_set_idx + 1) % MAX_SIZE == read_get_idx){
+        uart_stat.rx_bytes += batch;
+        if(batch > uart_stat.rx_batch_max) uart_stat.rx_batch_max = batch;
+        spin_unlock_irqrestore(&uart_lock, flags);
+        return;
+      }
+      char c = uart_ops->read();
+      /* convert carrige return to newline */
+      read_buf[read_set_idx] = c == '\r' ? '\n' : c;
+      read_set_idx = (read_set_idx + 1) % MAX_SIZE; /* reset the index if it reaches the end */
+      batch++;
+    }
+  }
+  uart_stat.rx_bytes += batch;
+  if(batch > uart_stat.rx_batch_max) uart_stat.rx_batch_max = batch;
+  spin_unlock_irqrestore(&uart_lock, flags);
   /* enable receive interrupt after set the new char */
-  enable_AUX_MU_IER_r(); 
+  uart_ops->rx_irq(1);
 }
 
 char async_uart_getc(){
-  enable_AUX_MU_IER_r();
+  uart_ops->rx_irq(1);
   /* wait until something is in the read buffer (read_set_idx != read_get_idx) */
   while(read_get_idx == read_set_idx) {asm volatile("nop");}
 
-  disable_irq();
+  unsigned long flags = spin_lock_irqsave(&uart_lock);
   char r = read_buf[read_get_idx]; /* read the char that set in read buffer already*/
   read_get_idx = (read_get_idx + 1) % MAX_SIZE; /* reset the index if it reaches the end */
-  enable_irq();
+  spin_unlock_irqrestore(&uart_lock, flags);
   
   return r;
 }
 
 /* Display a char */
 void uart_putc(unsigned int c){
-  /* 
-  wait until we can send
-  0x20/bit_6 is set if the transmit FIFO is empty and the
-  transmitter is idle. (Finished shifting out the last bit).
-  */
-  while(!(*AUX_MU_LSR & 0x20)) {asm volatile("nop");}
+  /* wait until the transmit FIFO has room */
+  while(uart_ops->tx_room() == 0) {asm volatile("nop");}
 
   /* write the character to the buffer */
-  *AUX_MU_IO = c;
+  uart_ops->write(c);
 }
 
+/* the top half: mask the transmit interrupt until the softirq refills the transmitter */
 void tran_interrupt_handler(){
-  /* finished sending the last char */
-  if(write_get_idx == write_set_idx){
-    disable_AUX_MU_IER_w();
-    return;
-  } 
+  uart_stat.tx_irq++;
+  uart_ops->tx_irq(0);
+  raise_softirq(UART_TX_SOFTIRQ);
+}
 
-  char c = write_buf[write_get_idx];
-  uart_putc(c);
-  write_get_idx = (write_get_idx + 1) % MAX_SIZE; /* reset the index if it reaches the end */
+/* 
+ * UART_TX_SOFTIRQ: refill the transmitter from write_buf.
+ * Fill the free room of the tx fifo, the next tx interrupt comes when it drains.
+ */
+void uart_tx_softirq(){
+  unsigned int batch = 0;
+  unsigned long flags = spin_lock_irqsave(&uart_lock);
+  while(write_get_idx != write_set_idx){
+    unsigned int room = uart_ops->tx_room();
+    if(room == 0) break;
+    while(room-- && write_get_idx != write_set_idx){
+      uart_ops->write(write_buf[write_get_idx]);
+      write_get_idx = (write_get_idx + 1) % UART_TX_BUF_SIZE; /* reset the index if it reaches the end */
+      batch++;
+    }
+  }
+  uart_stat.tx_bytes += batch;
+  if(batch > uart_stat.tx_batch_max) uart_stat.tx_batch_max = batch;
+
+  /* wake the writer up at half empty, not for every byte */
+  Thread *waiter = NULL;
+  unsigned int space = (write_get_idx + UART_TX_BUF_SIZE - write_set_idx - 1) % UART_TX_BUF_SIZE;
+  if(tx_waiter != NULL && space >= UART_TX_BUF_SIZE / 2){
+    waiter = tx_waiter;
+    tx_waiter = NULL;
+  }
+  int done = write_get_idx == write_set_idx;
+  spin_unlock_irqrestore(&uart_lock, flags);
+  if(waiter != NULL) wake_up_thread(waiter);
 
   /* finished sending the last char */
-  if(write_get_idx == write_set_idx){
-    disable_AUX_MU_IER_w();
-    return;
-  } 
+  if(done) return;
 
   /* enable transmit interrupt to expect print next char */
-  enable_AUX_MU_IER_w();
+  uart_ops->tx_irq(1);
+}
+
+/* 
+ * The pl011 tx interrupt only comes when the fifo drains through its level,
+ * so an idle transmitter is filled here, then the interrupt keeps it going.
+ */
+static void uart_start_tx(){
+  if(uart_ops->tx_room() == uart_ops->fifo_size) uart_tx_softirq();
+  else uart_ops->tx_irq(1);
 }
 
 void async_uart_putc(unsigned int c){
   /* buffer is full, wait the sending char */
-  while((write_set_idx + 1) % MAX_SIZE == write_get_idx) {enable_AUX_MU_IER_w();}
+  while((write_set_idx + 1) % UART_TX_BUF_SIZE == write_get_idx) {uart_start_tx();}
   
 
-  disable_irq();
+  unsigned long flags = spin_lock_irqsave(&uart_lock);
   write_buf[write_set_idx] = (char)c;
-  write_set_idx = (write_set_idx + 1) % MAX_SIZE; /* reset the index if it reaches the end */
-  enable_irq();
+  write_set_idx = (write_set_idx + 1) % UART_TX_BUF_SIZE; /* reset the index if it reaches the end */
+  spin_unlock_irqrestore(&uart_lock, flags);
 
   /* enable transmit interrupt after set the new char */
-  enable_AUX_MU_IER_w();
+  uart_start_tx();
+}
+
+/* 
+ * Wait for the room of write_buf.
+ * Sleep until the tx softirq wakes us up, only one writer sleeps,
+ * the others (and the callers that can't sleep) yield or spin.
+ * Return -1 if the thread is killed.
+ */
+static int uart_tx_wait(){
+  Thread *curr_thread = get_current();
+  if(curr_thread == NULL || curr_thread->preempt_count != 0 || irqs_disabled()){
+    asm volatile("nop");
+    return 0;
+  }
+  if(prepare_to_sleep() < 0) return -1;
+  /* the irq is masked by prepare_to_sleep */
+  spin_lock(&uart_lock);
+  if((write_set_idx + 1) % UART_TX_BUF_SIZE == write_get_idx && (tx_waiter == NULL || tx_waiter == curr_thread)){
+    tx_waiter = curr_thread;
+    spin_unlock(&uart_lock);
+    uart_ops->tx_irq(1);
+    schedule();
+    return 0;
+  }
+  int full = (write_set_idx + 1) % UART_TX_BUF_SIZE == write_get_idx;
+  spin_unlock(&uart_lock);
+  sleep_cancel();
+  if(full) schedule();
+  return 0;
+}
+
+/*
+ * Copy len bytes to write_buf and return, the tx interrupt sends them.
+ * crlf: convert newline to carrige return + newline, like uart_nbyte.
+ * The bytes may go out after the ones of uart_putc that is called later.
+ * Return the number of the queued bytes.
+ */
+unsigned int async_uart_write(const char *buf, unsigned int len, int crlf){
+  unsigned int i = 0;
+  int cr = 0; // the '\r' of buf[i] is queued
+  while(i < len){
+    unsigned long flags = spin_lock_irqsave(&uart_lock);
+    while(i < len && (write_set_idx + 1) % UART_TX_BUF_SIZE != write_get_idx){
+      if(crlf && buf[i] == '\n' && !cr){
+        write_buf[write_set_idx] = '\r';
+        cr = 1;
+      }
+      else{
+        write_buf[write_set_idx] = buf[i++];
+        cr = 0;
+      }
+      write_set_idx = (write_set_idx + 1) % UART_TX_BUF_SIZE; /* reset the index if it reaches the end */
+    }
+    spin_unlock_irqrestore(&uart_lock, flags);
+    uart_start_tx();
+    if(i < len && uart_tx_wait() < 0) break;
+  }
+  return i;
 }
 
 /* Async display a string */
@@ -172,4 +369,22 @@ void disable_AUX_MU_IER_r(){
 
 void disable_AUX_MU_IER_w(){
   *AUX_MU_IER &= ~2;
-}
\ No newline at end of file
+}
+
+void uart_rx_overrun(){
+  uart_stat.rx_overrun++;
+}
+
+void print_uart_stat(){
+  uart_puts("[*] ");
+  uart_puts((char *)uart_ops->name);
+  print_string(UITOA, " | rx overrun: ", uart_stat.rx_overrun, 1);
+  print_string(UITOA, "[rx] irqs: ", uart_stat.rx_irq, 0);
+  print_string(UITOA, " | bytes: ", uart_stat.rx_bytes, 0);
+  print_string(UITOA, " | irqs per KB: ", uart_stat.rx_bytes ? uart_stat.rx_irq * 1024 / uart_stat.rx_bytes : 0, 0);
+  print_string(UITOA, " | max batch: ", uart_stat.rx_batch_max, 1);
+  print_string(UITOA, "[tx] irqs: ", uart_stat.tx_irq, 0);
+  print_string(UITOA, " | bytes: ", uart_stat.tx_bytes, 0);
+  print_string(UITOA, " | irqs per KB: ", uart_stat.tx_bytes ? uart_stat.tx_irq * 1024 / uart_stat.tx_bytes : 0, 0);
+  print_string(UITOA, " | max batch: ", uart_stat.tx_batch_max, 1);
+}
@@ -0,0 +1,31 @@
+#include <user_syscall.h>
+#include <vdso.h>
+#include <stddef.h>
+
+/*
+ * The clocks of the user library, computed at EL0 from the time data and cntpct_el0.
+ * Only the first call traps to get the address of the time data.
+ */
+static const VdsoData *vdso;
+
+int clock_gettime(int clk_id, struct timespec *tp){
+    long sec, nsec;
+    if(tp == NULL || (clk_id != CLOCK_REALTIME && clk_id != CLOCK_MONOTONIC))
+        return -1;
+    if(vdso == NULL)
+        vdso = get_vdso_data();
+    vdso_read(vdso, clk_id == CLOCK_REALTIME, &sec, &nsec);
+    tp->tv_sec = sec;
+    tp->tv_nsec = nsec;
+    return 0;
+}
+
+/* tz is obsolete, ignored */
+int gettimeofday(struct timeval *tv, void *tz){
+    struct timespec ts;
+    if(tv == NULL || clock_gettime(CLOCK_REALTIME, &ts) < 0)
+        return -1;
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
+    return 0;
+}
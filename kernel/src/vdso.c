@@ -0,0 +1,63 @@
+#include <vdso.h>
+#include <spinlock.h>
+#include <uart.h>
+#include <string.h>
+#include <stddef.h>
+
+/* a page of its own, nothing else of the kernel is next to it */
+VdsoData vdso_data __attribute__((aligned(4096)));
+static Spinlock vdso_lock;
+
+void vdso_init(){
+    spin_lock_init(&vdso_lock, "vdso_lock");
+    vdso_data.seq = 0;
+    asm volatile(
+        "mrs %0, cntfrq_el0\n\t"
+        "isb\n\t"
+        "mrs %1, cntpct_el0\n\t"
+        :"=r"(vdso_data.cntfrq), "=r"(vdso_data.boot_cnt)
+    );
+    /* no rtc, the wall clock starts at the epoch until settimeofday */
+    vdso_data.wall_sec = 0;
+    vdso_data.wall_nsec = 0;
+}
+
+/* set CLOCK_REALTIME to sec.nsec now */
+void vdso_settime(long long sec, long long nsec){
+    long mono_sec, mono_nsec;
+    unsigned long flags = spin_lock_irqsave(&vdso_lock);
+    vdso_read(&vdso_data, 0, &mono_sec, &mono_nsec);
+    sec -= mono_sec;
+    nsec -= mono_nsec;
+    if(nsec < 0){
+        nsec += 1000000000;
+        sec--;
+    }
+
+    vdso_data.seq++;
+    asm volatile("dmb ishst\n\t" ::: "memory");
+    vdso_data.wall_sec = sec;
+    vdso_data.wall_nsec = nsec;
+    asm volatile("dmb ishst\n\t" ::: "memory");
+    vdso_data.seq++;
+    spin_unlock_irqrestore(&vdso_lock, flags);
+}
+
+void print_date(){
+    long sec, nsec;
+    vdso_read(&vdso_data, 1, &sec, &nsec);
+    print_string(UITOA, "[*] realtime: ", sec, 0);
+    print_string(UITOA, " s ", nsec / 1000, 0);
+    vdso_read(&vdso_data, 0, &sec, &nsec);
+    print_string(UITOA, " us | monotonic: ", sec, 0);
+    print_string(UITOA, " s ", nsec / 1000, 0);
+    uart_puts(" us\n");
+}
+
+/* date [seconds since the epoch] */
+void date_arg(char *buf){
+    char *arg = strchr(buf, ' ');
+    if(arg != NULL && *(arg + 1) != '\0')
+        vdso_settime(atoui(arg + 1), 0);
+    print_date();
+}
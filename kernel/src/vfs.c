@@ -3,20 +3,22 @@
 #include <string.h>
 #include <tmpfs.h>
 #include <uart.h>
+#include <printk.h>
 #include <cpio.h>
 #include <dev_ops.h>
+#include <sched.h>
 
-char *global_dir;
-Dentry *global_dentry;
-File **global_fd_table;
 Mount *rootfs;
 FileSystem **fs_pool;
+/* protect the dentry tree, the mounts and the tmpfs data, it is never taken in the irq */
+Spinlock vfs_lock;
 
 extern file_info **cpio_file_info_list;
 extern struct file_operations* uart_file_ops;
 extern struct file_operations* framebuffer_file_ops;
 
 void rootfs_init(char *fs_name){
+    spin_lock_init(&vfs_lock, "vfs_lock");
     fs_pool = (FileSystem **)kmalloc(sizeof(FileSystem *) * MAX_FS_NUM);
     for(unsigned int idx = 0; idx < MAX_FS_NUM; idx++){
         FileSystem *init_fs = (FileSystem *)kmalloc(sizeof(FileSystem));
@@ -34,15 +36,14 @@ void rootfs_init(char *fs_name){
     }
 
     int err = register_filesystem(fs_pool[0]);
-    if(err) uart_puts("[x] Failed to register filesystem\n");
+    if(err) printk(LOGLEVEL_ERR, "[x] Failed to register filesystem\n");
     
     rootfs = (Mount *)kmalloc(sizeof(Mount));
     fs_pool[0]->setup_mount(fs_pool[0], rootfs); // NULL: rootfs no parent
 
-    global_dir = (char *)kmalloc(sizeof(char) * 1024);
+    /* the working directory and fd table of the current thread (the shell) */
     strcpy(global_dir, "/");
     global_dentry = rootfs->root_dentry;
-    global_fd_table = (File **)kmalloc(sizeof(File *) * MAX_FD_NUM);
 
     vfs_initramfs_init();
     vfs_dev_init();
@@ -96,11 +97,11 @@ int register_filesystem(FileSystem *fs) {
     
     if(strcmp(fs->name, "tmpfs") == 0){
         tmpfs_set_ops();
-        uart_puts("[*] Registered tmpfs\n");
+        printk(LOGLEVEL_INFO, "[*] Registered tmpfs\n");
     }
     else{
         tmpfs_set_ops();
-        uart_puts("[*] Registered another fs\n");
+        printk(LOGLEVEL_INFO, "[*] Registered another fs\n");
     }
 
     return 0;
@@ -179,15 +180,13 @@ int vfs_lookup(const char* pathname, Dentry **target_path, VNode **target_vnode,
 
 int vfs_open(const char* pathname, int flags, struct file** target_file) {
     if(pathname == NULL) return -1;
-    uart_puts("[*] vfs_open: ");
-    uart_puts((char *)pathname);
-    print_string(ITOA, " | flag: ", flags, 1);
+    printk(LOGLEVEL_DEBUG, "[*] vfs_open: %s | flag: %d\n", pathname, flags);
     Dentry *target_path = NULL;
     VNode *target_vnode = NULL;
     char component_name[MAX_PATHNAME_LEN];
     int err = vfs_lookup(pathname, &target_path, &target_vnode, component_name);
     if(err){
-        uart_puts("[*] Open: cannot find the pathname\n");
+        printk(LOGLEVEL_INFO, "[*] Open: cannot find the pathname\n");
         return -1; // worng pathname  
     } 
     // 2. Create a new file handle for this vnode if found.
@@ -195,12 +194,12 @@ int vfs_open(const char* pathname, int flags, struct file** target_file) {
         // cannot open a directory
         if(target_vnode->dentry->type == D_DIR || 
             target_vnode->dentry->type == D_MOUNT){
-                uart_puts("[*] Open: Cannot open a directory\n");
+                printk(LOGLEVEL_INFO, "[*] Open: Cannot open a directory\n");
                 return -2; 
             } 
         err = rootfs->root_dentry->vnode->f_ops->open(target_vnode, target_file);
         if(err == -1){
-            uart_puts("[*] Open: Cannot open a file\n");
+            printk(LOGLEVEL_INFO, "[*] Open: Cannot open a file\n");
             return -1;
         } 
         return 0;
@@ -210,35 +209,31 @@ int vfs_open(const char* pathname, int flags, struct file** target_file) {
     else{
         if(flags & O_CREAT){
             if(target_path->mount->fs->read_only){
-                uart_puts("[*] Open: Cannot create a file in read only filesystem\n");
+                printk(LOGLEVEL_INFO, "[*] Open: Cannot create a file in read only filesystem\n");
                 return -3;
             } 
             err = rootfs->root_dentry->vnode->v_ops->create(target_path->vnode, &target_vnode, component_name);
             if(err){
-                uart_puts("[*] Open: Cannot create a file\n");
+                printk(LOGLEVEL_INFO, "[*] Open: Cannot create a file\n");
                 return err;
             } 
             err = rootfs->root_dentry->vnode->f_ops->open(target_vnode, target_file);
             if(err){
-                uart_puts("[*] Open: Cannot open a file\n");
+                printk(LOGLEVEL_INFO, "[*] Open: Cannot open a file\n");
                 return err;
             } 
-            uart_puts("[*] Created file: ");
-            uart_puts((*target_file)->vnode->dentry->name);
-            uart_puts("\n");
+            printk(LOGLEVEL_DEBUG, "[*] Created file: %s\n", (*target_file)->vnode->dentry->name);
             return 0;
         }
     }
-    uart_puts("[*] Open: Cannot open a file\n");
+    printk(LOGLEVEL_INFO, "[*] Open: Cannot open a file\n");
     // 4. Return error code if fails
     return -1;
 }
 
 int vfs_mknod(const char *pathname, enum file_type filetype){
     if(pathname == NULL) return -1;
-    uart_puts("[*] vfs_mknod: ");
-    uart_puts((char *)pathname);
-    uart_puts("\n");
+    printk(LOGLEVEL_DEBUG, "[*] vfs_mknod: %s\n", pathname);
     Dentry *target_path = NULL;
     VNode *target_vnode = NULL;
     char component_name[MAX_PATHNAME_LEN];
@@ -247,19 +242,17 @@ int vfs_mknod(const char *pathname, enum file_type filetype){
 
     /* target vnode is exist, cannot create it */
     if(target_vnode != NULL){
-        uart_puts("[*] Mknod: Target is already exist\n");
+        printk(LOGLEVEL_INFO, "[*] Mknod: Target is already exist\n");
         return -2;
     } 
 
     /* create the special file */
     err = rootfs->root_dentry->vnode->v_ops->create(target_path->vnode, &target_vnode, component_name);
     if(err){
-        uart_puts("[*] Open: Cannot create a file\n");
+        printk(LOGLEVEL_INFO, "[*] Open: Cannot create a file\n");
         return err;
     }
-    uart_puts("[*] Created file: ");
-    uart_puts(target_vnode->dentry->name);
-    uart_puts("\n");
+    printk(LOGLEVEL_DEBUG, "[*] Created file: %s\n", target_vnode->dentry->name);
 
     /* set the file type */
     switch (filetype)
@@ -278,10 +271,8 @@ int vfs_mknod(const char *pathname, enum file_type filetype){
 }
 
 int vfs_mkdir(const char *pathname){
-    uart_puts("[*] vfs_mkdir: ");
-    uart_puts((char *)pathname);
-    uart_puts("\n");
     if(pathname == NULL) return -1;
+    printk(LOGLEVEL_DEBUG, "[*] vfs_mkdir: %s\n", pathname);
 
     Dentry *target_path = NULL;
     VNode *target_vnode = NULL;
@@ -291,13 +282,13 @@ int vfs_mkdir(const char *pathname){
 
     // folder already exist
     if(target_vnode != NULL){
-        uart_puts("[*] Mkdir: folder already exist\n");
+        printk(LOGLEVEL_INFO, "[*] Mkdir: folder already exist\n");
         return -2;
     } 
 
     // cannot create a file in read only filesystem
     if(target_path->mount->fs->read_only){
-        uart_puts("[*] Mkdir: cannot create a folder in read-only filesystem\n");
+        printk(LOGLEVEL_INFO, "[*] Mkdir: cannot create a folder in read-only filesystem\n");
         return -3;
     }  
 
@@ -380,9 +371,7 @@ int vfs_chdir(const char *pathname){
     Dentry *target_path = NULL;
     VNode *target_vnode = NULL;
     char component_name[MAX_PATHNAME_LEN];
-    uart_puts("[*] vfs_chdir: ");
-    uart_puts((char *)pathname);
-    uart_puts("\n");
+    printk(LOGLEVEL_DEBUG, "[*] vfs_chdir: %s\n", pathname);
 
     /* just cd is goto root path */
     if(pathname == NULL){
@@ -404,13 +393,13 @@ int vfs_chdir(const char *pathname){
 
     /* file/folder not exist */
     if(target_vnode == NULL){
-        uart_puts("[*] Chdir: No such file or directory\n");
+        printk(LOGLEVEL_INFO, "[*] Chdir: No such file or directory\n");
         return -2;
     } 
     
     /* cannot change to a file */
     if(target_vnode->dentry->type == D_FILE){
-        uart_puts("[*] Chdir: Cannot change to a file\n");
+        printk(LOGLEVEL_INFO, "[*] Chdir: Cannot change to a file\n");
         return -3;
     }  
 
@@ -424,9 +413,7 @@ int vfs_chdir(const char *pathname){
 
 int vfs_mount(const char *pathname, const char *filesystem){
     if(filesystem == NULL) return -1;
-    uart_puts("[*] vfs_mount: ");
-    uart_puts((char *)pathname);
-    uart_puts("\n");
+    printk(LOGLEVEL_DEBUG, "[*] vfs_mount: %s\n", pathname);
     // print_string(UITOA, "path_len: ", strlen(pathname), 0);
     // print_string(UITOA, " | filefs_len: ", strlen(filesystem), 1);
     Dentry *target_path = NULL;
@@ -438,19 +425,19 @@ int vfs_mount(const char *pathname, const char *filesystem){
     // uart_puts(target_vnode->dentry->name);
     /* target vnode isn't exist, cannot mount it */
     if(target_vnode == NULL){
-        uart_puts("[*] Mount: No such file or directory\n");
+        printk(LOGLEVEL_INFO, "[*] Mount: No such file or directory\n");
         return -2;
     } 
 
     /* target is not a directory, cannot mount it */
     if(target_vnode->dentry->type != D_DIR){
-        uart_puts("[*] Mount: Target is not a directory, connot mount it\n");
+        printk(LOGLEVEL_INFO, "[*] Mount: Target is not a directory, connot mount it\n");
         return -3;
     } 
 
     /* cannot mount in read only filesystem */
     if(target_path->mount->fs->read_only){
-        uart_puts("[*] Mount: Cannot mount in a read-only filesystem\n");
+        printk(LOGLEVEL_INFO, "[*] Mount: Cannot mount in a read-only filesystem\n");
         return -3;
     } 
         
@@ -474,7 +461,7 @@ int vfs_mount(const char *pathname, const char *filesystem){
     fs_pool[idx]->setup_mount = tmpfs_setup_mount;
     target_fs = fs_pool[idx];
     err = register_filesystem(target_fs);
-    if(err) uart_puts("[x] Failed to register another filesystem\n");
+    if(err) printk(LOGLEVEL_ERR, "[x] Failed to register another filesystem\n");
     new_mount = (Mount *)kmalloc(sizeof(Mount));
     target_fs->setup_mount(target_fs, new_mount);
 
@@ -492,9 +479,7 @@ MOUNT_FS:;
     target_vnode->dentry->mount = new_mount;
 
     char *mount_fs_name = target_fs->name;
-    uart_puts("[*] Mount: mount \"");
-    uart_puts(mount_fs_name);
-    uart_puts("\" filesystem success\n");
+    printk(LOGLEVEL_INFO, "[*] Mount: mount \"%s\" filesystem success\n", mount_fs_name);
 
     return 0;
 }
@@ -508,12 +493,12 @@ int vfs_umount(const char *pathname){
 
     /* target vnode isn't exist, cannot umount it */
     if(target_vnode == NULL){
-        uart_puts("[*] Umount: No such file or directory\n");
+        printk(LOGLEVEL_INFO, "[*] Umount: No such file or directory\n");
         return -2;
     } 
     /* target isn't a mount point */
     if(target_vnode->dentry->type != D_MOUNT){
-        uart_puts("[*] Umount: Target is not a mount point, connot umount it\n");
+        printk(LOGLEVEL_INFO, "[*] Umount: Target is not a mount point, connot umount it\n");
         return -3;
     }  
 
@@ -524,9 +509,7 @@ int vfs_umount(const char *pathname){
     target_vnode->dentry->mount->mount_parent = NULL;
 
     char *umount_fs_name = target_vnode->dentry->mount->fs->name;
-    uart_puts("[*] Umount: umount \"");
-    uart_puts(umount_fs_name);
-    uart_puts("\" filesystem success\n");
+    printk(LOGLEVEL_INFO, "[*] Umount: umount \"%s\" filesystem success\n", umount_fs_name);
 
     // kfree(target_vnode->dentry->mount);
     target_vnode->dentry->mount = target_vnode->dentry->parent->mount;
@@ -548,7 +531,7 @@ int vfs_write(struct file* file, const void* buf, size_t len) {
     // 2. return written size or error code if an error occurs.
     if(file == NULL) return -1;
     if(file->vnode->dentry->mount->fs->read_only == 1){
-        uart_puts("[*] Write: Cannot write to a read-only filesystem\n");
+        printk(LOGLEVEL_INFO, "[*] Write: Cannot write to a read-only filesystem\n");
         return -2;
     } 
     // uart_puts("[*] vfs_write | ");
@@ -566,9 +549,32 @@ int vfs_read(struct file* file, void* buf, size_t len) {
     return file->f_ops->read(file, buf, len);
 }
 
-int vfs_lseek64(struct file* file, long offset, int whence) {
+long vfs_lseek64(struct file* file, long offset, int whence) {
     // 1. change the file offset according to whence
     // 2. return the new offset or error code if an error occurs.
     if(file == NULL) return -1;
     return file->f_ops->lseek64(file, offset, whence);
-}
\ No newline at end of file
+}
+
+int vfs_pread(struct file* file, void* buf, size_t len, long pos) {
+    // read like vfs_read at pos, f_pos is not changed
+    if(file == NULL || pos < 0) return -1;
+    if(file->f_ops->pread == NULL) return -1;
+    return file->f_ops->pread(file, buf, len, pos);
+}
+
+int vfs_pwrite(struct file* file, const void* buf, size_t len, long pos) {
+    // write like vfs_write at pos, f_pos is not changed
+    if(file == NULL || pos < 0) return -1;
+    if(file->vnode->dentry->mount->fs->read_only == 1){
+        printk(LOGLEVEL_INFO, "[*] Write: Cannot write to a read-only filesystem\n");
+        return -2;
+    }
+    if(file->f_ops->pwrite == NULL) return -1;
+    return file->f_ops->pwrite(file, buf, len, pos);
+}
+
+/* the device file (uart, framebuffer) has its own buffer, read/write it without vfs_lock */
+int vfs_is_dev(struct file* file){
+    return file->f_ops == uart_file_ops || file->f_ops == framebuffer_file_ops;
+}
@@ -0,0 +1,171 @@
+#include <workqueue.h>
+#include <atomic.h>
+#include <sched.h>
+#include <uart.h>
+#include <stddef.h>
+#include <string.h>
+
+WorkQueue workqueues[NR_CPUS];
+extern Cpu cpus[NR_CPUS];
+
+void init_work(Work *work, WorkFunc func, void *data){
+    work->next = NULL;
+    work->func = func;
+    work->data = data;
+    work->pending = 0;
+    work->cpu = 0;
+}
+
+/* 
+ * Push the work on the queue of the cpu and wake up its worker.
+ * It doesn't allocate or take a lock unless the worker sleeps, so it is safe in the irq handler.
+ * Return 0 if the work is pending already.
+ */
+int queue_work_on(unsigned int cpu, Work *work){
+    if(atomic_xchg32(&work->pending, 1))
+        return 0;
+    work->cpu = cpu;
+
+    WorkQueue *wq = &workqueues[cpu];
+    unsigned long old, head = (unsigned long)wq->head;
+    while(1){
+        work->next = (Work *)head;
+        old = atomic_cmpxchg((volatile unsigned long *)&wq->head, head, (unsigned long)work);
+        if(old == head) break;
+        head = old;
+    }
+
+    /* pairs with the barrier in worker_thread between SLEEPING and checking the list */
+    asm volatile("dmb ish\n\t" ::: "memory");
+    Thread *worker = wq->worker;
+    if(worker != NULL && worker->state == SLEEPING && wake_up_thread(worker)){
+        /* the deferred work of this cpu runs before the thread it interrupted */
+        if(cpu == smp_processor_id())
+            set_need_resched();
+    }
+    return 1;
+}
+
+/* queue it on this cpu */
+int queue_work(Work *work){
+    unsigned long flags = local_irq_save();
+    int ret = queue_work_on(smp_processor_id(), work);
+    local_irq_restore(flags);
+    return ret;
+}
+
+typedef struct _WorkBarrier{
+    Work work;
+    Thread *waiter;
+    volatile int done;
+}WorkBarrier;
+
+static void work_barrier_func(void *data){
+    WorkBarrier *barrier = (WorkBarrier *)data;
+    Thread *waiter = barrier->waiter;
+    asm volatile("dmb ish\n\t" ::: "memory");
+    barrier->done = 1;
+    wake_up_thread(waiter);
+}
+
+/* 
+ * Wait until the last queued instance of the work has finished.
+ * A barrier work is queued behind it, the queue of a cpu runs in order.
+ * Don't call it in the irq handler or in the work itself.
+ */
+void flush_work(Work *work){
+    WorkQueue *wq = &workqueues[work->cpu];
+    if(!work->pending && wq->current_work != work)
+        return;
+
+    WorkBarrier barrier;
+    init_work(&barrier.work, work_barrier_func, &barrier);
+    barrier.waiter = get_current();
+    barrier.done = 0;
+    queue_work_on(work->cpu, &barrier.work);
+
+    while(!barrier.done){
+        if(prepare_to_sleep() < 0) break;
+        if(barrier.done){
+            sleep_cancel();
+            break;
+        }
+        schedule();
+    }
+}
+
+/* the list is pushed in LIFO order, reverse it */
+static Work *work_list_reverse(Work *list, unsigned int *count){
+    Work *prev = NULL;
+    *count = 0;
+    while(list != NULL){
+        Work *next = list->next;
+        list->next = prev;
+        prev = list;
+        list = next;
+        (*count)++;
+    }
+    return prev;
+}
+
+/* kworker/n, it only runs on cpu n */
+static void worker_thread(){
+    WorkQueue *wq = &workqueues[smp_processor_id()];
+    while(1){
+        Work *list = (Work *)atomic_xchg((volatile unsigned long *)&wq->head, 0);
+        if(list == NULL){
+            /* a work queued after the check wakes us up */
+            if(prepare_to_sleep() < 0) return;
+            asm volatile("dmb ish\n\t" ::: "memory");
+            if(wq->head != NULL){
+                sleep_cancel();
+                continue;
+            }
+            schedule();
+            continue;
+        }
+
+        unsigned int count;
+        list = work_list_reverse(list, &count);
+        wq->nr_batch++;
+        if(count > wq->max_batch) wq->max_batch = count;
+        while(list != NULL){
+            Work *work = list;
+            list = work->next;
+            /* current_work first, flush_work sees one of them */
+            wq->current_work = work;
+            asm volatile("dmb ish\n\t" ::: "memory");
+            work->pending = 0;
+            asm volatile("dmb ish\n\t" ::: "memory");
+            work->func(work->data);
+            wq->current_work = NULL;
+            wq->nr_done++;
+        }
+    }
+}
+
+/* start a worker for every online cpu, the work queued before runs now */
+void workqueue_init(){
+    char name[] = "kworker/0";
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        if(!cpus[i].online) continue;
+        name[8] = '0' + i;
+        Thread *worker = kthread_create(worker_thread, name, i);
+        if(worker == NULL){
+            print_string(UITOA, "[x] workqueue: no worker for cpu", i, 1);
+            continue;
+        }
+        workqueues[i].worker = worker;
+    }
+}
+
+void print_workqueue(){
+    for(unsigned int i = 0; i < NR_CPUS; i++){
+        if(workqueues[i].worker == NULL) continue;
+        print_string(UITOA, "kworker/", i, 0);
+        print_string(UITOA, " | pid: ", workqueues[i].worker->id, 0);
+        print_string(UITOA, " | done: ", workqueues[i].nr_done, 0);
+        print_string(UITOA, " | batch: ", workqueues[i].nr_batch, 0);
+        print_string(UITOA, " | max batch: ", workqueues[i].max_batch, 1);
+    }
+}
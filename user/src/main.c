@@ -2,6 +2,8 @@
 #include <string.h>
 #include <user_syscall.h>
 #include <mailbox.h>
+#include <stddef.h>
+#include <io_ring.h>
 
 int readline2(char buf[MAX_SIZE], int size){
   unsigned int idx = 0;
@@ -36,20 +38,14 @@ int readline2(char buf[MAX_SIZE], int size){
   return idx;
 }
 
+/* sleep for time ticks of cntpct, the thread doesn't use the cpu while sleeping */
 void delay1(unsigned long long time){
-    unsigned long long system_timer = 0;
-    asm volatile(
-        "mrs %0, cntpct_el0\n\t"
-        :"=r"(system_timer)
-    );
-    unsigned long long expired_time = system_timer + time;
-    while(system_timer <= expired_time){
-        asm volatile(
-            "mrs %0, cntpct_el0\n\t"
-            :"=r"(system_timer)
-        );
-    }
-    
+    unsigned long long frq = 0;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+    struct timespec req;
+    req.tv_sec = time / frq;
+    req.tv_nsec = (time % frq) * 1000000000 / frq;
+    nanosleep(&req, NULL);
 }
 
 int get_arm_memory1(unsigned int *mbox){
@@ -67,9 +63,92 @@ int get_arm_memory1(unsigned int *mbox){
   return mbox_call(MAILBOX_CH_PROP, mbox);
 }
 
+#define SYSCALL_BENCH_NUM 10000
+
+/* the null syscall latency: getpid takes the fast path of start.S, null_syscall the full trap frame */
+void syscall_bench(){
+    unsigned long long frq, start, end;
+    asm volatile("mrs %0, cntfrq_el0\n\t" :"=r"(frq));
+
+    asm volatile("isb\n\tmrs %0, cntpct_el0\n\t" :"=r"(start));
+    for(int i = 0; i < SYSCALL_BENCH_NUM; i++) getpid();
+    asm volatile("isb\n\tmrs %0, cntpct_el0\n\t" :"=r"(end));
+    print_string(UITOA, "[user] getpid(ns): ", (end - start) * 1000000000 / frq / SYSCALL_BENCH_NUM, 1);
+
+    asm volatile("isb\n\tmrs %0, cntpct_el0\n\t" :"=r"(start));
+    for(int i = 0; i < SYSCALL_BENCH_NUM; i++) null_syscall();
+    asm volatile("isb\n\tmrs %0, cntpct_el0\n\t" :"=r"(end));
+    print_string(UITOA, "[user] null syscall(ns): ", (end - start) * 1000000000 / frq / SYSCALL_BENCH_NUM, 1);
+}
+
+#define IO_RING_TEST_FILE "/io_ring_test"
+
+/* open, write, seek back, read and close a file with one trap */
+void io_ring_test(){
+    static const char msg[] = "hello io ring";
+    char buf[sizeof(msg)];
+    IoRing *ring = io_ring_setup();
+    if(ring == NULL){
+        uart_puts("[user] io_ring_setup failed\n");
+        return;
+    }
+
+    IoRingSqe *sqe = io_ring_get_sqe(ring);
+    sqe->opcode = IO_RING_OP_OPEN;
+    sqe->addr = (unsigned long)IO_RING_TEST_FILE;
+    sqe->len = O_CREAT;
+    io_ring_queue_sqe(ring);
+
+    sqe = io_ring_get_sqe(ring);
+    sqe->opcode = IO_RING_OP_WRITE;
+    sqe->fd = IO_RING_FD_LAST;
+    sqe->addr = (unsigned long)msg;
+    sqe->len = sizeof(msg) - 1;
+    io_ring_queue_sqe(ring);
+
+    sqe = io_ring_get_sqe(ring);
+    sqe->opcode = IO_RING_OP_LSEEK64;
+    sqe->fd = IO_RING_FD_LAST;
+    sqe->off = 0;
+    sqe->len = SEEK_SET;
+    io_ring_queue_sqe(ring);
+
+    sqe = io_ring_get_sqe(ring);
+    sqe->opcode = IO_RING_OP_READ;
+    sqe->fd = IO_RING_FD_LAST;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = sizeof(msg) - 1;
+    sqe->user_data = 1; // the read
+    io_ring_queue_sqe(ring);
+
+    sqe = io_ring_get_sqe(ring);
+    sqe->opcode = IO_RING_OP_CLOSE;
+    sqe->fd = IO_RING_FD_LAST;
+    io_ring_queue_sqe(ring);
+
+    print_string(UITOA, "[user] io ring submitted: ", io_ring_enter(ring, IO_RING_ENTRIES), 1);
+    IoRingCqe *cqe;
+    while((cqe = io_ring_peek_cqe(ring)) != NULL){
+        if(cqe->user_data == 1 && cqe->res > 0){
+            buf[cqe->res] = '\0';
+            uart_puts("[user] io ring read: ");
+            uart_puts(buf);
+            uart_puts("\n");
+        }
+        else if(cqe->res < 0)
+            print_string(ITOA, "[user] io ring op failed: ", cqe->res, 1);
+        io_ring_cqe_seen(ring);
+    }
+}
+
 int main(){
     uart_puts("----------------------------user program2----------------------------\n");
     print_string(UITOA, "[user] Fork Test, pid = ", getpid(), 1);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    print_string(UITOA, "[user] uptime(ms): ", now.tv_sec * 1000 + now.tv_nsec / 1000000, 1);
+    syscall_bench();
+    io_ring_test();
     int cnt = 1;
     int ret = 0;
     unsigned int mbox[36];